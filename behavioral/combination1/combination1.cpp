@@ -5,35 +5,88 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+#include "../../common/async_log.h"
+#include "../../common/block_pool.h"
+#include "../../common/metrics.h"
 
 class Subscriber {
 public:
-    virtual void notify(const std::string & publisherName, const std::string & message) = 0;
+    virtual ~Subscriber() = default;
+    virtual void notify(const std::string & publisherName, std::string_view message) = 0;
     virtual std::string getName() = 0;
 };
 
+// Calls subscriber->notify() and records how long it took against the
+// subscriber's metrics slot.
+inline void notifySubscriber(Subscriber *subscriber, size_t metricsSlot, const std::string & publisherName, std::string_view message) {
+    LapTimer timer;
+    subscriber->notify(publisherName, message);
+    timer.lapNotify(metricsSlot);
+}
+
 class Publisher {
 public:
+    virtual ~Publisher() = default;
     virtual void subscribe(Subscriber *subscriber) = 0;
     virtual void unsubscribe(Subscriber *subscriber) = 0;
-    virtual void publish(const std::string & message) = 0;
+    virtual void publish(std::string_view message) = 0;
 };
 
 class ChatGroup : public Publisher {
     std::string groupName;
     std::vector<Subscriber*> subscribers;
+    // Metrics slots of the group and, in step with subscribers, of each
+    // subscriber; subscribers themselves know nothing about metrics.
+    size_t metricsSlot;
+    std::vector<size_t> subscriberSlots;
 public:
-    ChatGroup(const std::string & name) : groupName(name) {};
+    ChatGroup(const std::string & name) : groupName(name), metricsSlot(Metrics::registerGroup(name)) {};
+    const std::string & getName() const { return groupName; };
+    const std::vector<Subscriber*> & getSubscribers() const { return subscribers; };
+    size_t getMetricsSlot() const { return metricsSlot; };
+    const std::vector<size_t> & getSubscriberSlots() const { return subscriberSlots; };
     void subscribe(Subscriber *subscriber) override {
         this->subscribers.push_back(subscriber);
+        subscriberSlots.push_back(Metrics::registerSubscriber(subscriber->getName()));
     };
     void unsubscribe(Subscriber *subscriber) override {
-        subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(), [subscriber](Subscriber *s) { return s->getName() == subscriber->getName(); }), subscribers.end());
+        size_t kept = 0;
+        for (size_t i = 0; i < subscribers.size(); i++) {
+            if (subscribers[i]->getName() != subscriber->getName()) {
+                subscribers[kept] = subscribers[i];
+                subscriberSlots[kept] = subscriberSlots[i];
+                kept++;
+            }
+        }
+        subscribers.resize(kept);
+        subscriberSlots.resize(kept);
     };
-    void publish(const std::string & message) override {
-        for (auto subscriber : subscribers) {
-            subscriber->notify(groupName, message);
+    // One clock read per notification: each lap closes one subscriber's
+    // notify and the publish is the sum of the laps.
+    void publish(std::string_view message) override {
+        LapTimer timer;
+        Metrics::countFanout(metricsSlot, subscribers.size());
+        for (size_t i = 0; i < subscribers.size(); i++) {
+            subscribers[i]->notify(groupName, message);
+            timer.lapNotify(subscriberSlots[i]);
         }
+        timer.total(Metrics::Publish);
     };
 };
 
@@ -41,27 +94,46 @@ class ChatUser : public Subscriber {
     std::string userName;
 public:
     ChatUser(const std::string & userName) : userName(userName) {};
-    void notify(const std::string & publisherName, const std::string & message) override {
-        std::cout << userName << " received a new message from " << publisherName << ": " << message << "\n";
+    void notify(const std::string & publisherName, std::string_view message) override {
+        LOG_INFO(userName, " received a new message from ", publisherName, ": ", message);
     }
     std::string getName() override { return userName; };
 };
 
+static constexpr size_t commandBlockSize = 64;
+
 class MessageCommand {
 public:
     virtual ~MessageCommand() {};
+    // Commands are created and destroyed per message, so they come from a pool
+    // rather than the global allocator.
+    static void *operator new(size_t size) {
+        return size <= commandBlockSize ? BlockPool<commandBlockSize>::allocate() : ::operator new(size);
+    }
+    static void operator delete(void *pointer, size_t size) {
+        if (size <= commandBlockSize) {
+            BlockPool<commandBlockSize>::deallocate(pointer);
+        } else {
+            ::operator delete(pointer);
+        }
+    }
     virtual void execute() = 0;
-    virtual std::string getMessage() = 0;
+    virtual std::string_view getMessage() = 0;
+    virtual MessagePayload getPayload() = 0;
+    virtual ChatGroup *getChatGroup() = 0;
 };
 
 class SendMessageCommand: public MessageCommand {
     ChatGroup *chatGroup;
-    std::string message;
+    MessagePayload message;
 public:
-    SendMessageCommand(ChatGroup *chatGroup, std::string message) : chatGroup(chatGroup), message(message) {};
-    std::string getMessage() override { return message; };
+    SendMessageCommand(ChatGroup *chatGroup, MessagePayload message) : chatGroup(chatGroup), message(std::move(message)) {};
+    std::string_view getMessage() override { return message.view(); };
+    MessagePayload getPayload() override { return message; };
+    ChatGroup *getChatGroup() override { return chatGroup; };
     void execute() override {
-        chatGroup->publish(message);
+        StageTimer timer(Metrics::Execute);
+        chatGroup->publish(message.view());
     }
 };
 
@@ -74,11 +146,13 @@ public:
 
 class BaseHandler : public Handler {
 protected:
-    Handler *next = nullptr;
+    // Each handler owns its successor, so deleting the head of a chain frees
+    // the whole chain.
+    std::unique_ptr<Handler> next;
 public:
-    ~BaseHandler() { delete next; };
+    // Takes ownership of nextValidator; a previously set successor is freed.
     Handler *setNext(Handler *nextValidator) override {
-        next = nextValidator;
+        next.reset(nextValidator);
         return nextValidator;
     }
     virtual std::string handle(MessageCommand *command) override {
@@ -92,11 +166,13 @@ public:
 class NotEmptyValidator: public BaseHandler {
 public:
     std::string handle(MessageCommand *command) override {
-        std::cout << "Checking if empty...\n";
+        LOG_DEBUG("Checking if empty...");
         
+        StageTimer timer(Metrics::Validate);
         if (command->getMessage().empty()) {
             return "Please enter a value";
         }
+        timer.stop();
         
         return BaseHandler::handle(command);
     }
@@ -107,11 +183,13 @@ class LengthValidator: public BaseHandler {
 public:
     LengthValidator(int minLength) : minLength(minLength) {};
     std::string handle(MessageCommand *command) override {
-        std::cout << "Checking if length equals" << minLength << "...\n";
+        LOG_DEBUG("Checking if length equals", minLength, "...");
         
+        StageTimer timer(Metrics::Validate);
         if (command->getMessage().length() < minLength) {
             return "Please enter a value longer than " + std::to_string(minLength);
         }
+        timer.stop();
         
         return BaseHandler::handle(command);
     }
@@ -125,7 +203,292 @@ public:
     }
 };
 
+// Bounded single-producer/single-consumer ring. Neither end blocks or takes a
+// lock: each side only ever writes its own index.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    T slots[Capacity];
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+public:
+    bool push(T value) {
+        size_t back = tail.load(std::memory_order_relaxed);
+        if (back - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        slots[back & (Capacity - 1)] = std::move(value);
+        tail.store(back + 1, std::memory_order_release);
+        return true;
+    }
+    bool empty() const {
+        return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+    }
+    bool pop(T &value) {
+        size_t front = head.load(std::memory_order_relaxed);
+        if (front == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(slots[front & (Capacity - 1)]);
+        head.store(front + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// Thread-per-core runtime. Every ChatGroup and every Subscriber is owned by
+// exactly one shard, and only that shard's thread ever touches it, so group
+// state needs no locks. A command is routed to the shard owning its group;
+// that shard notifies its own subscribers directly and sends a delivery
+// message to the owning shard of every other subscriber. Shards talk through
+// one SPSC queue per (sender, receiver) pair, plus one per shard for the
+// submitting thread. A queue is only allocated when its sender first uses it,
+// so memory follows the pairs that actually talk rather than shards squared.
+// A shard that finds nothing to do for a while parks on a condition variable
+// until a sender wakes it, instead of spinning.
+//
+// Register groups with addGroup() before start(); submit() must always be
+// called from the same thread. The runtime owns submitted commands.
+class ShardedRuntime {
+    struct Envelope {
+        MessageCommand *command = nullptr;
+        Subscriber *subscriber = nullptr;
+        size_t subscriberSlot = Metrics::unregistered;
+        const std::string *groupName = nullptr;
+        MessagePayload payload;
+    };
+    static constexpr size_t queueCapacity = 256;
+    static constexpr size_t idleRoundsBeforePark = 64;
+    using Queue = SpscQueue<Envelope, queueCapacity>;
+
+    struct Shard {
+        // inbox[i] is written by shard i; inbox.back() by the submitting
+        // thread. Each is null until its sender first needs it, and only that
+        // sender ever sets it.
+        std::vector<std::atomic<Queue*>> inbox;
+        // Deliveries that did not fit into a full queue, per target shard.
+        // Only this shard's thread uses them, so a full queue never blocks it.
+        std::vector<std::deque<Envelope>> overflow;
+        std::atomic<bool> parked{false};
+        std::mutex parkMutex;
+        std::condition_variable unparked;
+        std::thread thread;
+
+        Shard(size_t shardCount) : inbox(shardCount + 1), overflow(shardCount) {}
+        ~Shard() {
+            for (auto &queue : inbox) {
+                delete queue.load();
+            }
+        }
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::unordered_map<const void*, size_t> owners;
+    size_t nextShard = 0;
+    std::atomic<bool> running{false};
+    // Envelopes sent but not yet handled; drain() waits for this to hit zero.
+    std::atomic<long> inFlight{0};
+
+    size_t assign(const void *owned) {
+        auto found = owners.emplace(owned, nextShard);
+        if (found.second) {
+            nextShard = (nextShard + 1) % shards.size();
+        }
+        return found.first->second;
+    }
+
+    // The queue `from` writes into `to`'s inbox through, allocated on first use.
+    Queue &outbox(size_t from, size_t to) {
+        std::atomic<Queue*> &slot = shards[to]->inbox[from];
+        Queue *queue = slot.load(std::memory_order_relaxed);
+        if (!queue) {
+            queue = new Queue;
+            slot.store(queue, std::memory_order_release);
+        }
+        return *queue;
+    }
+
+    // Called after pushing to `to`. The fence pairs with the one in park(): either
+    // the shard sees the new envelope before parking, or this sees it parked.
+    void wake(size_t to) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        Shard &target = *shards[to];
+        if (target.parked.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(target.parkMutex);
+            target.parked.store(false, std::memory_order_relaxed);
+            target.unparked.notify_one();
+        }
+    }
+
+    void send(size_t from, size_t to, Envelope envelope) {
+        Shard &source = *shards[from];
+        if (!source.overflow[to].empty() || !outbox(from, to).push(envelope)) {
+            source.overflow[to].push_back(std::move(envelope));
+        } else {
+            wake(to);
+        }
+    }
+
+    // Returns true if any deliveries are still waiting for room.
+    bool flushOverflow(size_t from) {
+        Shard &source = *shards[from];
+        bool waiting = false;
+        for (size_t to = 0; to < shards.size(); to++) {
+            auto &pending = source.overflow[to];
+            if (pending.empty()) {
+                continue;
+            }
+            Queue &queue = outbox(from, to);
+            while (!pending.empty() && queue.push(pending.front())) {
+                pending.pop_front();
+            }
+            wake(to);
+            waiting = waiting || !pending.empty();
+        }
+        return waiting;
+    }
+
+    bool hasWork(Shard &shard) {
+        for (auto &slot : shard.inbox) {
+            Queue *queue = slot.load(std::memory_order_acquire);
+            if (queue && !queue->empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void park(Shard &shard) {
+        shard.parked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (hasWork(shard) || !running.load(std::memory_order_acquire)) {
+            shard.parked.store(false, std::memory_order_relaxed);
+            return;
+        }
+        std::unique_lock<std::mutex> lock(shard.parkMutex);
+        shard.unparked.wait(lock, [&shard] { return !shard.parked.load(std::memory_order_relaxed); });
+    }
+
+    void handle(size_t index, Envelope &envelope) {
+        if (envelope.subscriber) {
+            notifySubscriber(envelope.subscriber, envelope.subscriberSlot, *envelope.groupName, envelope.payload.view());
+            return;
+        }
+        ChatGroup *group = envelope.command->getChatGroup();
+        MessagePayload payload = envelope.command->getPayload();
+        Metrics::countFanout(group->getMetricsSlot(), group->getSubscribers().size());
+        const auto &subscribers = group->getSubscribers();
+        const auto &slots = group->getSubscriberSlots();
+        for (size_t i = 0; i < subscribers.size(); i++) {
+            size_t owner = owners.at(subscribers[i]);
+            if (owner == index) {
+                notifySubscriber(subscribers[i], slots[i], group->getName(), payload.view());
+            } else {
+                inFlight++;
+                send(index, owner, {nullptr, subscribers[i], slots[i], &group->getName(), payload});
+            }
+        }
+        delete envelope.command;
+    }
+
+    void run(size_t index) {
+        pinToCore(index);
+        Shard &shard = *shards[index];
+        Envelope envelope;
+        size_t idleRounds = 0;
+        while (running.load(std::memory_order_acquire)) {
+            const bool blocked = flushOverflow(index);
+            bool idle = true;
+            for (auto &slot : shard.inbox) {
+                Queue *queue = slot.load(std::memory_order_acquire);
+                while (queue && queue->pop(envelope)) {
+                    idle = false;
+                    handle(index, envelope);
+                    envelope = Envelope();
+                    inFlight--;
+                }
+            }
+            if (!idle || blocked) {
+                idleRounds = 0;
+                if (blocked) {
+                    std::this_thread::yield();
+                }
+            } else if (++idleRounds < idleRoundsBeforePark) {
+                std::this_thread::yield();
+            } else {
+                park(shard);
+                idleRounds = 0;
+            }
+        }
+    }
+
+    static void pinToCore(size_t index) {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+    }
+public:
+    ShardedRuntime(size_t shardCount) {
+        for (size_t i = 0; i < shardCount; i++) {
+            shards.push_back(std::make_unique<Shard>(shardCount));
+        }
+    }
+    ~ShardedRuntime() { stop(); }
+
+    // Gives the group, and any of its subscribers not yet placed, an owner.
+    void addGroup(ChatGroup *group) {
+        assign(group);
+        for (auto subscriber : group->getSubscribers()) {
+            assign(subscriber);
+        }
+    }
+
+    void start() {
+        running = true;
+        for (size_t i = 0; i < shards.size(); i++) {
+            shards[i]->thread = std::thread(&ShardedRuntime::run, this, i);
+        }
+    }
+
+    void submit(MessageCommand *command) {
+        inFlight++;
+        const size_t owner = owners.at(command->getChatGroup());
+        Queue &queue = outbox(shards.size(), owner);
+        Envelope envelope{command, nullptr, Metrics::unregistered, nullptr, {}};
+        while (!queue.push(envelope)) {
+            wake(owner);
+            std::this_thread::yield();
+        }
+        wake(owner);
+    }
+
+    // Waits until every submitted command has reached all of its subscribers.
+    void drain() {
+        while (inFlight.load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    void stop() {
+        drain();
+        running = false;
+        for (size_t i = 0; i < shards.size(); i++) {
+            wake(i);
+        }
+        for (auto &shard : shards) {
+            if (shard->thread.joinable()) {
+                shard->thread.join();
+            }
+        }
+    }
+};
+
+#ifdef DEMO_MAIN
 int main(int argc, const char * argv[]) {
+    Metrics::setSlowSubscriberThreshold(std::chrono::microseconds(100));
+    
     ChatUser *user1 = new ChatUser("Jim");
     ChatUser *user2 = new ChatUser("Barb");
     ChatUser *user3 = new ChatUser("Hannah");
@@ -151,10 +514,32 @@ int main(int argc, const char * argv[]) {
     SendMessageCommand *sayHelloToGroup1 = new SendMessageCommand(group1, "Hello everyone in group 1!");
     SendMessageCommand *sayHelloToGroup2 = new SendMessageCommand(group2, "Hello everyone in group 2!");
     
-    std::cout << "Sending empty message:\n" << sendMessageChain->handle(emptyMessage) << "\n\n";
-    std::cout << "Sending short message:\n" << sendMessageChain->handle(tooShortMessage) << "\n\n";
-    std::cout << "Sending message to group 1:\n" << sendMessageChain->handle(sayHelloToGroup1) << "\n\n";
-    std::cout << "Sending message to group 2:\n" << sendMessageChain->handle(sayHelloToGroup2) << "\n\n";
+    // The handlers log asynchronously; flush so their lines come before the reply.
+    auto send = [&](const char *description, MessageCommand *command) {
+        std::cout << description;
+        std::string reply = sendMessageChain->handle(command);
+        asynclog::flush();
+        std::cout << reply << "\n\n";
+    };
+    send("Sending empty message:\n", emptyMessage);
+    send("Sending short message:\n", tooShortMessage);
+    send("Sending message to group 1:\n", sayHelloToGroup1);
+    send("Sending message to group 2:\n", sayHelloToGroup2);
+
+    std::cout << "Sending through a sharded runtime:\n";
+    ShardedRuntime runtime(2);
+    runtime.addGroup(group1);
+    runtime.addGroup(group2);
+    runtime.start();
+    runtime.submit(new SendMessageCommand(group1, "Tomatoes are in!"));
+    runtime.submit(new SendMessageCommand(group2, "Walk at noon?"));
+    runtime.stop();
+    asynclog::flush();
+    std::cout << "\n";
+
+    std::cout << "Message path metrics:\n";
+    Metrics::snapshot().writeText(std::cout);
+    std::cout << "\n";
     
     delete user1;
     delete user2;
@@ -168,4 +553,5 @@ int main(int argc, const char * argv[]) {
     delete sendMessageChain;
     
     return 0;
-}
\ No newline at end of file
+}
+#endif
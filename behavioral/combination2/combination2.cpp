@@ -4,6 +4,27 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "../../common/async_log.h"
 
 class Visitor {
 public:
@@ -18,6 +39,94 @@ public:
     std::string accept(Visitor *v) { return v->handlePerson(name, age); };
 };
 
+// The per-person values a compiled card is rendered with.
+struct CardFields {
+    std::string_view name;
+    int age;
+};
+
+// Compiled form of a card template: literal text with person fields spliced
+// in between, plus jumps for age-based conditionals. A card's exact size is
+// known before it is rendered, and rendering it is just a few copies into
+// the caller's buffer.
+struct CardLayout {
+    enum SegmentKind { Literal, Name, Age, From, JumpUnless, Jump };
+    enum Comparison { Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual };
+    struct Segment {
+        SegmentKind kind;
+        std::string text;
+        // JumpUnless continues at target unless "age <comparison> operand";
+        // Jump always continues at target.
+        Comparison comparison = Equal;
+        int operand = 0;
+        size_t target = 0;
+    };
+    std::vector<Segment> segments;
+
+    size_t sizeFor(const CardFields &fields) const {
+        size_t size = 0;
+        evaluate(fields, [&size](std::string_view text) { size += text.size(); });
+        return size;
+    }
+    char *render(char *out, const CardFields &fields) const {
+        evaluate(fields, [&out](std::string_view text) { out = std::copy(text.begin(), text.end(), out); });
+        return out;
+    }
+    // Replaces every From segment with the sender's name.
+    CardLayout bind(const std::string & from) const {
+        CardLayout bound = *this;
+        for (auto &segment : bound.segments) {
+            if (segment.kind == From) {
+                segment = {Literal, from};
+            }
+        }
+        return bound;
+    }
+private:
+    static bool holds(Comparison comparison, int age, int operand) {
+        switch (comparison) {
+        case Less: return age < operand;
+        case LessEqual: return age <= operand;
+        case Greater: return age > operand;
+        case GreaterEqual: return age >= operand;
+        case Equal: return age == operand;
+        case NotEqual: return age != operand;
+        }
+        return false;
+    }
+    template <typename Emit>
+    void evaluate(const CardFields &fields, Emit &&emit) const {
+        char ageText[16];
+        const size_t ageLength = std::to_chars(ageText, ageText + sizeof(ageText), fields.age).ptr - ageText;
+        for (size_t pc = 0; pc < segments.size();) {
+            const Segment &segment = segments[pc];
+            switch (segment.kind) {
+            case Literal:
+                emit(segment.text);
+                break;
+            case Name:
+                emit(fields.name);
+                break;
+            case Age:
+                emit(std::string_view(ageText, ageLength));
+                break;
+            case From:
+                break;
+            case JumpUnless:
+                if (!holds(segment.comparison, fields.age, segment.operand)) {
+                    pc = segment.target;
+                    continue;
+                }
+                break;
+            case Jump:
+                pc = segment.target;
+                continue;
+            }
+            pc++;
+        }
+    }
+};
+
 class GreetingCardTemplate : public Visitor {
     std::string from;
 protected:
@@ -39,6 +148,35 @@ public:
     std::string handlePerson(const std::string & name, int age) {
         return intro(name) + occasion() + closing(from);
     }
+    // Renders the card once with a marker in place of the name and splits the
+    // text around it, so subclasses that only override intro(), occasion()
+    // or closing() compile without extra code. That only works if the name
+    // is inserted verbatim and nothing depends on age, so the result is
+    // checked against handlePerson() for two different people; a template
+    // that fails the check must override compileLayout() itself.
+    virtual CardLayout compileLayout() {
+        static const std::string marker = "\x1f";
+        const std::string probe = intro(marker) + occasion() + closing(from);
+        CardLayout layout;
+        size_t start = 0;
+        for (size_t found = probe.find(marker); found != std::string::npos; found = probe.find(marker, start)) {
+            layout.segments.push_back({CardLayout::Literal, probe.substr(start, found - start)});
+            layout.segments.push_back({CardLayout::Name, ""});
+            start = found + marker.size();
+        }
+        layout.segments.push_back({CardLayout::Literal, probe.substr(start)});
+
+        static const std::pair<const char*, int> samples[] = {{"Ada", 7}, {"Grace Hopper", 85}};
+        for (const auto &sample : samples) {
+            const CardFields fields{sample.first, sample.second};
+            std::string rendered(layout.sizeFor(fields), '\0');
+            layout.render(&rendered[0], fields);
+            if (rendered != handlePerson(sample.first, sample.second)) {
+                throw std::logic_error("card template cannot be compiled from intro(), occasion() and closing(); override compileLayout()");
+            }
+        }
+        return layout;
+    }
 };
 
 class BirthdayCardTemplate : public GreetingCardTemplate {
@@ -62,6 +200,342 @@ public:
     NewYearsCardTemplate(const std::string & from) : GreetingCardTemplate(from) {};
 };
 
+// Parses card templates written as text, for example
+//
+//     Dear {{name}},
+//     {{#if age >= 50}}Happy {{age}}th, a true milestone!{{else}}Have a great one!{{/if}}
+//     Love, {{from}}
+//
+// into a CardLayout. Tags are {{name}}, {{age}}, {{from}} and conditionals
+// on age using <, <=, >, >=, == or !=, with an optional {{else}}.
+// Each source is compiled once and kept, keyed by file path or caller name.
+class CardTemplateCache {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<const CardLayout>> compiled;
+
+    static std::string_view trim(std::string_view text) {
+        while (!text.empty() && std::isspace(static_cast<unsigned char>(text.front()))) text.remove_prefix(1);
+        while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back()))) text.remove_suffix(1);
+        return text;
+    }
+
+    static CardLayout::Comparison parseComparison(std::string_view op) {
+        static const std::pair<std::string_view, CardLayout::Comparison> comparisons[] = {
+            {"<", CardLayout::Less}, {"<=", CardLayout::LessEqual}, {">", CardLayout::Greater},
+            {">=", CardLayout::GreaterEqual}, {"==", CardLayout::Equal}, {"!=", CardLayout::NotEqual}
+        };
+        for (const auto &comparison : comparisons) {
+            if (comparison.first == op) {
+                return comparison.second;
+            }
+        }
+        throw std::invalid_argument("unknown comparison '" + std::string(op) + "'");
+    }
+
+    static CardLayout parse(std::string_view source) {
+        CardLayout layout;
+        std::vector<size_t> openJumps;
+        size_t position = 0;
+        while (position < source.size()) {
+            size_t open = source.find("{{", position);
+            if (open != position) {
+                layout.segments.push_back({CardLayout::Literal, std::string(source.substr(position, open - position))});
+                if (open == std::string_view::npos) {
+                    break;
+                }
+            }
+            size_t close = source.find("}}", open);
+            if (close == std::string_view::npos) {
+                throw std::invalid_argument("unterminated tag");
+            }
+            std::string_view tag = trim(source.substr(open + 2, close - open - 2));
+            position = close + 2;
+
+            if (tag == "name") {
+                layout.segments.push_back({CardLayout::Name, ""});
+            } else if (tag == "age") {
+                layout.segments.push_back({CardLayout::Age, ""});
+            } else if (tag == "from") {
+                layout.segments.push_back({CardLayout::From, ""});
+            } else if (tag.substr(0, 3) == "#if" && (tag.size() == 3 || std::isspace(static_cast<unsigned char>(tag[3])))) {
+                // "#if age <op> <number>"
+                std::string_view condition = trim(tag.substr(3));
+                size_t fieldLength = std::min(condition.find_first_of("<>=! \t\r\n\f\v"), condition.size());
+                if (condition.substr(0, fieldLength) != "age") {
+                    throw std::invalid_argument("conditions must test age: '" + std::string(tag) + "'");
+                }
+                condition = trim(condition.substr(fieldLength));
+                size_t opLength = condition.find_first_not_of("<>=!");
+                if (condition.empty() || opLength == 0) {
+                    throw std::invalid_argument("missing comparison in '" + std::string(tag) + "'");
+                }
+                CardLayout::Segment jump{CardLayout::JumpUnless, ""};
+                jump.comparison = parseComparison(condition.substr(0, opLength));
+                std::string_view number = trim(condition.substr(std::min(opLength, condition.size())));
+                if (std::from_chars(number.data(), number.data() + number.size(), jump.operand).ptr != number.data() + number.size() || number.empty()) {
+                    throw std::invalid_argument("bad age in '" + std::string(tag) + "'");
+                }
+                openJumps.push_back(layout.segments.size());
+                layout.segments.push_back(jump);
+            } else if (tag == "else") {
+                if (openJumps.empty()) {
+                    throw std::invalid_argument("{{else}} without {{#if}}");
+                }
+                layout.segments.push_back({CardLayout::Jump, ""});
+                layout.segments[openJumps.back()].target = layout.segments.size();
+                openJumps.back() = layout.segments.size() - 1;
+            } else if (tag == "/if") {
+                if (openJumps.empty()) {
+                    throw std::invalid_argument("{{/if}} without {{#if}}");
+                }
+                layout.segments[openJumps.back()].target = layout.segments.size();
+                openJumps.pop_back();
+            } else {
+                throw std::invalid_argument("unknown tag '" + std::string(tag) + "'");
+            }
+        }
+        if (!openJumps.empty()) {
+            throw std::invalid_argument("{{#if}} without {{/if}}");
+        }
+        return layout;
+    }
+public:
+    std::shared_ptr<const CardLayout> compile(const std::string & key, std::string_view source) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = compiled.find(key);
+        if (found == compiled.end()) {
+            found = compiled.emplace(key, std::make_shared<const CardLayout>(parse(source))).first;
+        }
+        return found->second;
+    }
+    std::shared_ptr<const CardLayout> load(const std::string & path) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = compiled.find(path);
+            if (found != compiled.end()) {
+                return found->second;
+            }
+        }
+        std::ifstream file(path);
+        if (!file) {
+            throw std::runtime_error("cannot open card template " + path);
+        }
+        std::stringstream source;
+        source << file.rdbuf();
+        return compile(path, source.str());
+    }
+};
+
+// A card template loaded at runtime. It renders from its compiled layout, so
+// the Visitor path never reparses the text.
+class TextCardTemplate : public GreetingCardTemplate {
+    CardLayout layout;
+public:
+    TextCardTemplate(const CardLayout & compiled, const std::string & from) : GreetingCardTemplate(from), layout(compiled.bind(from)) {};
+    std::string handlePerson(const std::string & name, int age) override {
+        const CardFields fields{name, age};
+        std::string card(layout.sizeFor(fields), '\0');
+        layout.render(&card[0], fields);
+        return card;
+    }
+    CardLayout compileLayout() override {
+        return layout;
+    }
+};
+
+// Collects every person's fields, viewing names without copying them.
+class FieldCollector : public Visitor {
+public:
+    std::vector<CardFields> fields;
+    std::string handlePerson(const std::string & name, int age) override {
+        fields.push_back({name, age});
+        return {};
+    }
+};
+
+// Every card of one run in a single contiguous buffer; card i occupies
+// [offsets[i], offsets[i + 1]).
+class CardBatch {
+    std::unique_ptr<char[]> arena;
+    std::vector<size_t> offsets;
+public:
+    CardBatch(std::unique_ptr<char[]> arena, std::vector<size_t> offsets) : arena(std::move(arena)), offsets(std::move(offsets)) {};
+    size_t size() const { return offsets.size() - 1; };
+    size_t bytes() const { return offsets.back(); };
+    std::string_view operator[](size_t i) const {
+        return std::string_view(arena.get() + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+};
+
+// Buffered output for streamed cards. Cards are rendered straight into the
+// current buffer; a full buffer is handed to a writer thread, which flushes
+// every full buffer it finds with a single writev while rendering carries on
+// in the next one. Works with any file descriptor: a file, a pipe or stdout.
+class CardSink {
+    struct Buffer {
+        std::unique_ptr<char[]> data;
+        size_t used = 0;
+        bool full = false;
+    };
+    int fd;
+    size_t bufferSize;
+    std::vector<Buffer> buffers;
+    size_t current = 0;
+    size_t nextToWrite = 0;
+    // Read by bytes() while the writer is still adding to it.
+    std::atomic<size_t> bytesWritten{0};
+    int error = 0;
+    bool closing = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread writer;
+
+    void writeLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this] { return closing || buffers[nextToWrite].full; });
+            if (!buffers[nextToWrite].full) {
+                return;
+            }
+            std::vector<iovec> pieces;
+            for (size_t i = nextToWrite; buffers[i].full && pieces.size() < buffers.size(); i = (i + 1) % buffers.size()) {
+                pieces.push_back({buffers[i].data.get(), buffers[i].used});
+            }
+            lock.unlock();
+            int writeError = writeAll(pieces);
+            lock.lock();
+            for (size_t i = 0; i < pieces.size(); i++) {
+                bytesWritten.fetch_add(buffers[nextToWrite].used, std::memory_order_relaxed);
+                buffers[nextToWrite].used = 0;
+                buffers[nextToWrite].full = false;
+                nextToWrite = (nextToWrite + 1) % buffers.size();
+            }
+            error = error ? error : writeError;
+            changed.notify_all();
+        }
+    }
+
+    int writeAll(std::vector<iovec> &pieces) {
+        iovec *piece = pieces.data();
+        size_t remaining = pieces.size();
+        while (remaining > 0) {
+            ssize_t written = writev(fd, piece, int(remaining));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno;
+            }
+            while (remaining > 0 && size_t(written) >= piece->iov_len) {
+                written -= piece->iov_len;
+                piece++;
+                remaining--;
+            }
+            if (remaining > 0) {
+                piece->iov_base = static_cast<char*>(piece->iov_base) + written;
+                piece->iov_len -= written;
+            }
+        }
+        return 0;
+    }
+
+    // Flushes everything and stops the writer. Returns the first write error,
+    // or 0. Once the writer has stopped, only returns that error again.
+    int finish() {
+        if (!writer.joinable()) {
+            return error;
+        }
+        handOff();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        changed.notify_all();
+        writer.join();
+        return error;
+    }
+
+    // Hands the current buffer to the writer and waits for the next one.
+    void handOff() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (buffers[current].used == 0) {
+            return;
+        }
+        buffers[current].full = true;
+        changed.notify_all();
+        current = (current + 1) % buffers.size();
+        changed.wait(lock, [this] { return !buffers[current].full; });
+    }
+public:
+    CardSink(int fd, size_t bufferSize = 1 << 20, size_t bufferCount = 2) : fd(fd), bufferSize(bufferSize), buffers(std::max<size_t>(2, bufferCount)) {
+        for (auto &buffer : buffers) {
+            buffer.data.reset(new char[bufferSize]);
+        }
+        writer = std::thread(&CardSink::writeLoop, this);
+    }
+    // A sink that was never closed is flushed here. Errors cannot be thrown
+    // from a destructor, so they are logged; call close() to see them.
+    ~CardSink() {
+        if (writer.joinable()) {
+            if (int failure = finish()) {
+                LOG_ERROR("CardSink: writing cards failed: ", std::strerror(failure));
+            }
+        }
+    }
+
+    // Renders one card followed by a blank line.
+    void write(const CardLayout &layout, const CardFields &fields) {
+        const size_t size = layout.sizeFor(fields) + 1;
+        if (size > bufferSize) {
+            std::string card(size, '\n');
+            layout.render(&card[0], fields);
+            write(card);
+            return;
+        }
+        if (buffers[current].used + size > bufferSize) {
+            handOff();
+        }
+        Buffer &buffer = buffers[current];
+        *layout.render(buffer.data.get() + buffer.used, fields) = '\n';
+        buffer.used += size;
+    }
+    void write(std::string_view text) {
+        while (!text.empty()) {
+            Buffer &buffer = buffers[current];
+            size_t chunk = std::min(text.size(), bufferSize - buffer.used);
+            std::copy(text.begin(), text.begin() + chunk, buffer.data.get() + buffer.used);
+            buffer.used += chunk;
+            text.remove_prefix(chunk);
+            if (buffer.used == bufferSize) {
+                handOff();
+            }
+        }
+    }
+
+    // Flushes everything and stops the writer; throws if any write failed.
+    // Closing again does nothing more than report the same error.
+    void close() {
+        if (int failure = finish()) {
+            throw std::system_error(failure, std::generic_category(), "writing cards");
+        }
+    }
+
+    // Bytes written so far; all of them once close() has returned.
+    size_t bytes() const { return bytesWritten.load(std::memory_order_relaxed); }
+};
+
+// Renders each visited person's card straight into a sink.
+class SinkWriter : public Visitor {
+    const CardLayout &layout;
+    CardSink &sink;
+public:
+    SinkWriter(const CardLayout &layout, CardSink &sink) : layout(layout), sink(sink) {};
+    std::string handlePerson(const std::string & name, int age) override {
+        sink.write(layout, {name, age});
+        return {};
+    }
+};
+
 class GreetingCardGenerator {
     GreetingCardTemplate *temp;
     std::vector<Person*> people;
@@ -75,8 +549,51 @@ public:
         }
         return cards;
     }
+    // Bulk path: compiles the template once, sizes every card exactly, then
+    // renders them in parallel into one arena with no per-card allocation.
+    CardBatch createGreetingCardBatch(unsigned threadCount = std::thread::hardware_concurrency()) {
+        FieldCollector collector;
+        for (auto person : people) {
+            person->accept(&collector);
+        }
+        const std::vector<CardFields> &fields = collector.fields;
+        const CardLayout layout = temp->compileLayout();
+
+        std::vector<size_t> offsets(fields.size() + 1, 0);
+        for (size_t i = 0; i < fields.size(); i++) {
+            offsets[i + 1] = offsets[i] + layout.sizeFor(fields[i]);
+        }
+        std::unique_ptr<char[]> arena(new char[offsets.back()]);
+
+        static constexpr size_t minCardsPerThread = 4096;
+        const size_t workers = std::max<size_t>(1, std::min<size_t>(threadCount, fields.size() / minCardsPerThread));
+        auto renderRange = [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                layout.render(arena.get() + offsets[i], fields[i]);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t worker = 1; worker < workers; worker++) {
+            threads.emplace_back(renderRange, fields.size() * worker / workers, fields.size() * (worker + 1) / workers);
+        }
+        renderRange(0, fields.size() / workers);
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        return CardBatch(std::move(arena), std::move(offsets));
+    }
+    // Streaming path: renders every card into the sink as it goes and never
+    // holds more than the sink's buffers in memory.
+    void streamGreetingCards(CardSink &sink) {
+        const CardLayout layout = temp->compileLayout();
+        SinkWriter writer(layout, sink);
+        for (auto person : people) {
+            person->accept(&writer);
+        }
+    }
 };
  
+#ifdef DEMO_MAIN
 int main(int argc, const char * argv[]) {
     Person *person1 = new Person("John", 40);
     Person *person2 = new Person("Joan", 80);
@@ -97,10 +614,32 @@ int main(int argc, const char * argv[]) {
         std::cout << card << "\n";
     };
     
+    // Templates can also be loaded from a text file given on the command line.
+    CardTemplateCache templates;
+    std::shared_ptr<const CardLayout> milestone = argc > 1 ? templates.load(argv[1]) : templates.compile("milestone",
+        "Dear {{name}},\n"
+        "{{#if age >= 50}}Happy {{age}}th! Here's to the next {{age}} years.{{else}}Happy birthday, have a great one!{{/if}}\n"
+        "Love,\n{{from}}\n");
+    generator->setTemplate(new TextCardTemplate(*milestone, "Grandma"));
+    for (auto card : generator->createGreetingCards()) {
+        std::cout << card << "\n";
+    }
+    
+    CardBatch batch = generator->createGreetingCardBatch();
+    std::cout << "Rendered " << batch.size() << " cards (" << batch.bytes() << " bytes) in bulk:\n";
+    for (size_t i = 0; i < batch.size(); i++) {
+        std::cout << batch[i] << "\n";
+    }
+    
+    std::cout << "Streamed to stdout:\n" << std::flush;
+    CardSink sink(STDOUT_FILENO);
+    generator->streamGreetingCards(sink);
+    sink.close();
+    
     delete person1;
     delete person2;
     delete person3;
     
     return 0;
 }
-
+#endif
@@ -4,6 +4,286 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Immutable vector with structural sharing (a 32-way bit-partitioned trie
+// plus a tail block, as in Clojure's PersistentVector). push_back() returns a
+// new vector that shares every untouched node with the old one, so keeping
+// a snapshot per edit costs O(log n) new memory instead of a full copy, and
+// copying a vector is O(1).
+template <typename T>
+class PersistentVector {
+    static constexpr unsigned bits = 5;
+    static constexpr size_t width = size_t(1) << bits;
+    static constexpr size_t mask = width - 1;
+
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+    struct Node {
+        std::vector<NodePtr> children;
+        std::vector<T> values;
+    };
+
+    NodePtr root;
+    NodePtr tail;
+    size_t count = 0;
+    unsigned shift = bits;
+
+    size_t tailOffset() const {
+        return count < width ? 0 : ((count - 1) >> bits) << bits;
+    }
+    static NodePtr newPath(unsigned level, NodePtr node) {
+        if (level == 0) {
+            return node;
+        }
+        auto path = std::make_shared<Node>();
+        path->children.push_back(newPath(level - bits, std::move(node)));
+        return path;
+    }
+    NodePtr pushTail(unsigned level, const NodePtr &parent, NodePtr tailNode) const {
+        auto copy = parent ? std::make_shared<Node>(*parent) : std::make_shared<Node>();
+        const size_t index = ((count - 1) >> level) & mask;
+        NodePtr child;
+        if (level == bits) {
+            child = std::move(tailNode);
+        } else if (index < copy->children.size()) {
+            child = pushTail(level - bits, copy->children[index], std::move(tailNode));
+        } else {
+            child = newPath(level - bits, std::move(tailNode));
+        }
+        if (index < copy->children.size()) {
+            copy->children[index] = std::move(child);
+        } else {
+            copy->children.push_back(std::move(child));
+        }
+        return copy;
+    }
+    const Node *leafFor(size_t i) const {
+        if (i >= tailOffset()) {
+            return tail.get();
+        }
+        const Node *node = root.get();
+        for (unsigned level = shift; level > 0; level -= bits) {
+            node = node->children[(i >> level) & mask].get();
+        }
+        return node;
+    }
+    static NodePtr trimmed(const NodePtr &node, unsigned level, size_t last) {
+        auto copy = std::make_shared<Node>(*node);
+        const size_t index = (last >> level) & mask;
+        copy->children.resize(index + 1);
+        if (level > bits) {
+            copy->children[index] = trimmed(copy->children[index], level - bits, last);
+        }
+        return copy;
+    }
+    // First index in [base, limit) where the subtrees differ, or limit.
+    static size_t prefixOf(const Node *mine, const Node *theirs, unsigned level, size_t base, size_t limit) {
+        if (mine == theirs) {
+            return limit;
+        }
+        if (level == 0) {
+            for (size_t i = base; i < limit; i++) {
+                if (!(mine->values[i & mask] == theirs->values[i & mask])) {
+                    return i;
+                }
+            }
+            return limit;
+        }
+        const size_t span = size_t(1) << level;
+        for (size_t child = 0; base + child * span < limit; child++) {
+            const size_t childBase = base + child * span;
+            const size_t childLimit = std::min(limit, childBase + span);
+            size_t found = prefixOf(mine->children[child].get(), theirs->children[child].get(), level - bits, childBase, childLimit);
+            if (found < childLimit) {
+                return found;
+            }
+        }
+        return limit;
+    }
+public:
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    const T &operator[](size_t i) const {
+        return leafFor(i)->values[i & mask];
+    }
+
+    PersistentVector push_back(T value) const {
+        PersistentVector result = *this;
+        result.count = count + 1;
+        if (count - tailOffset() < width) {
+            auto newTail = tail ? std::make_shared<Node>(*tail) : std::make_shared<Node>();
+            newTail->values.push_back(std::move(value));
+            result.tail = std::move(newTail);
+            return result;
+        }
+        // The tail is full: move it into the trie, growing a level if needed.
+        if ((count >> bits) > (size_t(1) << shift)) {
+            auto newRoot = std::make_shared<Node>();
+            newRoot->children.push_back(root);
+            newRoot->children.push_back(newPath(shift, tail));
+            result.root = std::move(newRoot);
+            result.shift = shift + bits;
+        } else {
+            result.root = pushTail(shift, root, tail);
+        }
+        auto newTail = std::make_shared<Node>();
+        newTail->values.push_back(std::move(value));
+        result.tail = std::move(newTail);
+        return result;
+    }
+
+    // First `n` elements, sharing every block that stays whole.
+    PersistentVector take(size_t n) const {
+        if (n >= count) {
+            return *this;
+        }
+        PersistentVector result;
+        if (n == 0) {
+            return result;
+        }
+        result.count = n;
+        const size_t newTailOffset = ((n - 1) >> bits) << bits;
+        const Node *leaf = leafFor(n - 1);
+        auto newTail = std::make_shared<Node>();
+        newTail->values.assign(leaf->values.begin(), leaf->values.begin() + (n - newTailOffset));
+        result.tail = std::move(newTail);
+        if (newTailOffset == 0) {
+            return result;
+        }
+        NodePtr newRoot = trimmed(root, shift, newTailOffset - 1);
+        unsigned newShift = shift;
+        while (newShift > bits && newRoot->children.size() == 1) {
+            newRoot = newRoot->children[0];
+            newShift -= bits;
+        }
+        result.root = std::move(newRoot);
+        result.shift = newShift;
+        return result;
+    }
+
+    // Length of the longest common prefix of two vectors. Subtrees the two
+    // share are skipped without looking at their elements, so comparing a
+    // state with its successor after a push costs O(log n).
+    size_t commonPrefix(const PersistentVector &other) const {
+        const size_t limit = std::min(count, other.count);
+        const size_t trieLimit = std::min({limit, tailOffset(), other.tailOffset()});
+        size_t prefix = 0;
+        if (trieLimit > 0) {
+            const Node *mine = root.get();
+            const Node *theirs = other.root.get();
+            unsigned level = shift;
+            unsigned otherLevel = other.shift;
+            for (; level > otherLevel; level -= bits) {
+                mine = mine->children[0].get();
+            }
+            for (; otherLevel > level; otherLevel -= bits) {
+                theirs = theirs->children[0].get();
+            }
+            prefix = prefixOf(mine, theirs, level, 0, trieLimit);
+            if (prefix < trieLimit) {
+                return prefix;
+            }
+        }
+        for (; prefix < limit; prefix++) {
+            if (!((*this)[prefix] == other[prefix])) {
+                break;
+            }
+        }
+        return prefix;
+    }
+
+    // Visits the first `limit` elements, all of them by default.
+    template <typename Visit>
+    void forEach(Visit &&visit, size_t limit = SIZE_MAX) const {
+        limit = std::min(limit, count);
+        for (size_t i = 0; i < limit; i += width) {
+            const std::vector<T> &values = leafFor(i)->values;
+            const size_t end = std::min(values.size(), limit - i);
+            for (size_t j = 0; j < end; j++) {
+                visit(values[j]);
+            }
+        }
+    }
+    std::vector<T> toVector() const {
+        std::vector<T> values;
+        values.reserve(count);
+        forEach([&values](const T &value) { values.push_back(value); });
+        return values;
+    }
+};
+
+// Every distinct shape name is stored once, process-wide, and canvases refer
+// to it by a 32-bit id, so snapshots and diffs work on plain integers.
+// Interning takes a lock; looking a name up does not, because names live in
+// chunks that never move and are published by the release store of `count`.
+using ShapeId = uint32_t;
+
+class ShapeSymbols {
+    static constexpr unsigned chunkBits = 10;
+    static constexpr size_t chunkSize = size_t(1) << chunkBits;
+    static constexpr size_t maxChunks = 4096;
+
+    std::mutex mutex;
+    std::unordered_map<std::string_view, ShapeId> ids;
+    std::unique_ptr<std::string[]> chunks[maxChunks];
+    std::atomic<ShapeId> count{0};
+
+    ShapeSymbols() {};
+public:
+    static ShapeSymbols &instance() {
+        static ShapeSymbols symbols;
+        return symbols;
+    }
+    ShapeId intern(std::string_view name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = ids.find(name);
+        if (found != ids.end()) {
+            return found->second;
+        }
+        const ShapeId id = count.load(std::memory_order_relaxed);
+        if ((id >> chunkBits) >= maxChunks) {
+            throw std::length_error("too many distinct shape names");
+        }
+        auto &chunk = chunks[id >> chunkBits];
+        if (!chunk) {
+            chunk = std::make_unique<std::string[]>(chunkSize);
+        }
+        std::string &stored = chunk[id & (chunkSize - 1)];
+        stored.assign(name);
+        ids.emplace(stored, id);
+        count.store(id + 1, std::memory_order_release);
+        return id;
+    }
+    std::string_view name(ShapeId id) const {
+        if (id >= count.load(std::memory_order_acquire)) {
+            throw std::out_of_range("unknown shape id");
+        }
+        return chunks[id >> chunkBits][id & (chunkSize - 1)];
+    }
+};
+
+inline std::string_view shapeName(ShapeId id) {
+    return ShapeSymbols::instance().name(id);
+}
+
+using ShapeList = PersistentVector<ShapeId>;
 
 class Canvas;
 class ReplayCanvas;
@@ -11,9 +291,13 @@ class ReplayCanvas;
 class CanvasMemento {
     friend class Canvas;
     friend class ReplayCanvas;
-    const std::vector<std::string> shapes;
+    friend class DeltaHistory;
+    friend class ConcurrentCanvas;
+    // Shares structure with the neighbouring mementos, so a memento per edit
+    // does not copy the whole canvas.
+    const ShapeList shapes;
 public:
-    CanvasMemento(std::vector<std::string> shapes) : shapes(shapes) {};
+    CanvasMemento(ShapeList shapes) : shapes(std::move(shapes)) {};
 };
 
 class CanvasIterator {
@@ -40,7 +324,9 @@ public:
 
 class History {
 public:
+    virtual ~History() {};
     virtual void addState(CanvasMemento *newState) = 0;
+    // The state before the last one, or nullptr when there is nothing to undo.
     virtual CanvasMemento *undo() = 0;
 };
 
@@ -57,6 +343,10 @@ public:
         oldStates.push_back(newState);
     }
     CanvasMemento *undo() override {
+        if (oldStates.size() < 2) {
+            return nullptr;
+        }
+        delete oldStates.back();
         oldStates.pop_back();
         CanvasMemento *previousState = oldStates.back();
         return previousState;
@@ -79,28 +369,561 @@ public:
     };
 };
 
+// Difference between two consecutive canvas states: the new state keeps the
+// first `keep` shapes of the old one, drops the old shapes after them
+// (`removed`, kept so the step can be reversed) and appends `added`.
+struct CanvasDelta {
+    size_t keep;
+    std::vector<ShapeId> removed;
+    std::vector<ShapeId> added;
+};
+
+// Append-only scratch file. The file gets a fresh name beside `path`
+// (path.XXXXXX), so an existing file is never touched, and is unlinked as
+// soon as it is created, so nothing is left on disk afterwards. It is written
+// with pwrite() and read through a mapping whose pages the reader releases
+// once decoded, so spilled data sits in the page cache, not in our RSS.
+class SpillFile {
+    int fd = -1;
+    char *base = nullptr;
+    size_t capacity = 0;
+    size_t end = 0;
+
+    void map(size_t newCapacity) {
+        if (ftruncate(fd, newCapacity) != 0) {
+            throw std::system_error(errno, std::generic_category(), "ftruncate");
+        }
+        void *mapping = mmap(nullptr, newCapacity, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        }
+        if (base) {
+            munmap(base, capacity);
+        }
+        base = static_cast<char*>(mapping);
+        capacity = newCapacity;
+    }
+    void write(size_t offset, std::string_view bytes) {
+        while (!bytes.empty()) {
+            const ssize_t written = pwrite(fd, bytes.data(), bytes.size(), offset);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "pwrite");
+            }
+            bytes.remove_prefix(written);
+            offset += written;
+        }
+    }
+public:
+    SpillFile(const std::string & path) {
+        std::string name = path + ".XXXXXX";
+        fd = mkstemp(name.data());
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "mkstemp " + name);
+        }
+        unlink(name.c_str());
+        try {
+            map(1 << 20);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+    }
+    ~SpillFile() {
+        munmap(base, capacity);
+        close(fd);
+    }
+    size_t append(std::string_view bytes) {
+        if (end + bytes.size() > capacity) {
+            map(std::max(capacity * 2, end + bytes.size()));
+        }
+        write(end, bytes);
+        end += bytes.size();
+        return end - bytes.size();
+    }
+    // Replaces bytes already written; they must not run past the end.
+    void overwrite(size_t offset, std::string_view bytes) {
+        write(offset, bytes);
+    }
+    size_t size() const { return end; }
+    std::string_view read(size_t offset, size_t length) const {
+        return std::string_view(base + offset, length);
+    }
+    // Drops the pages read() mapped in for a range; the data stays in the file.
+    void release(size_t offset, size_t length) const {
+        const size_t page = sysconf(_SC_PAGESIZE);
+        const size_t from = offset - offset % page;
+        madvise(base + from, offset + length - from, MADV_DONTNEED);
+    }
+};
+
+// History stored as a full checkpoint every `checkpointInterval` steps plus a
+// compact delta per step. Any step can be rebuilt from the checkpoint at or
+// before it by applying at most checkpointInterval - 1 deltas, so replay can
+// seek anywhere and run in either direction. Checkpoints are ShapeLists, so
+// they share structure with each other and with the live canvas.
+//
+// A checkpoint and the deltas that follow it form a segment. Given a spill
+// file, only the newest `residentSegments` segments stay in memory; older ones
+// are written to the file in a compact varint encoding (not general-purpose
+// compression) and faulted back in when a replay or an undo() reaches them,
+// which bounds memory for long sessions.
+class DeltaHistory : public History {
+    struct Segment {
+        ShapeList checkpoint;
+        std::vector<CanvasDelta> deltas;
+        // The spill file holds this segment as it is now.
+        bool spilled = false;
+    };
+    struct SpillSlot {
+        size_t offset = 0;
+        size_t length = 0;
+        size_t capacity = 0;
+    };
+    size_t checkpointInterval;
+    size_t residentSegments;
+    std::unique_ptr<SpillFile> spill;
+    std::vector<Segment> segments;
+    // Where each segment is in the spill file, by index. Slots outlive the
+    // segments undo() drops, so a segment made again reuses its space.
+    std::vector<SpillSlot> slots;
+    // Segments before this index live only in the spill file.
+    size_t firstResident = 0;
+    // The most recently faulted-in segment.
+    Segment faulted;
+    size_t faultedIndex = SIZE_MAX;
+    size_t faults = 0;
+    size_t stepCount = 0;
+    ShapeList latest;
+    CanvasMemento *undone = nullptr;
+
+    // Segments are encoded as varints. Shape ids are process-wide, so the
+    // file stores them as they are; most fit in a byte or two. Decoding
+    // throws std::runtime_error on a truncated or corrupt segment rather than
+    // read past it or allocate whatever a bad count says.
+    static void putNumber(std::string &out, size_t value) {
+        while (value >= 0x80) {
+            out.push_back(char(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(char(value));
+    }
+    static size_t getNumber(std::string_view &in) {
+        size_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (in.empty()) {
+                throw std::runtime_error("spilled segment is truncated");
+            }
+            unsigned char byte = in.front();
+            in.remove_prefix(1);
+            value |= size_t(byte & 0x7f) << shift;
+            if (byte < 0x80) {
+                return value;
+            }
+        }
+        throw std::runtime_error("spilled segment holds a number over 64 bits");
+    }
+    // Every entry takes at least one byte, so a count beyond what is left
+    // can only come from a corrupt segment.
+    static size_t getCount(std::string_view &in) {
+        const size_t count = getNumber(in);
+        if (count > in.size()) {
+            throw std::runtime_error("spilled segment claims " + std::to_string(count) + " entries in " + std::to_string(in.size()) + " bytes");
+        }
+        return count;
+    }
+    static void putShapes(std::string &out, const std::vector<ShapeId> &shapes) {
+        putNumber(out, shapes.size());
+        for (ShapeId shape : shapes) {
+            putNumber(out, shape);
+        }
+    }
+    static void getShapes(std::string_view &in, std::vector<ShapeId> &shapes) {
+        shapes.resize(getCount(in));
+        for (ShapeId &shape : shapes) {
+            shape = ShapeId(getNumber(in));
+        }
+    }
+    static std::string encode(const Segment &segment) {
+        std::string out;
+        putShapes(out, segment.checkpoint.toVector());
+        putNumber(out, segment.deltas.size());
+        for (const auto &delta : segment.deltas) {
+            putNumber(out, delta.keep);
+            putShapes(out, delta.removed);
+            putShapes(out, delta.added);
+        }
+        return out;
+    }
+    static Segment decode(std::string_view in) {
+        Segment segment;
+        std::vector<ShapeId> checkpoint;
+        getShapes(in, checkpoint);
+        for (ShapeId shape : checkpoint) {
+            segment.checkpoint = segment.checkpoint.push_back(shape);
+        }
+        segment.deltas.resize(getCount(in));
+        for (auto &delta : segment.deltas) {
+            delta.keep = getNumber(in);
+            getShapes(in, delta.removed);
+            getShapes(in, delta.added);
+        }
+        if (!in.empty()) {
+            throw std::runtime_error("spilled segment has " + std::to_string(in.size()) + " bytes left over");
+        }
+        return segment;
+    }
+
+    void evictOldSegments() {
+        while (spill && segments.size() - firstResident > residentSegments) {
+            Segment &oldest = segments[firstResident];
+            // A segment undo() brought back is written again only if it has
+            // changed since, and then into its old slot when that is big enough.
+            if (!oldest.spilled) {
+                const std::string bytes = encode(oldest);
+                if (slots.size() <= firstResident) {
+                    slots.resize(firstResident + 1);
+                }
+                SpillSlot &slot = slots[firstResident];
+                if (bytes.size() <= slot.capacity) {
+                    spill->overwrite(slot.offset, bytes);
+                } else {
+                    slot.offset = spill->append(bytes);
+                    slot.capacity = bytes.size();
+                }
+                slot.length = bytes.size();
+                oldest.spilled = true;
+            }
+            oldest.checkpoint = ShapeList();
+            oldest.deltas = std::vector<CanvasDelta>();
+            firstResident++;
+        }
+    }
+
+    const Segment &segmentAt(size_t index) {
+        if (index >= firstResident) {
+            return segments[index];
+        }
+        if (faultedIndex != index) {
+            faulted = decode(spill->read(slots[index].offset, slots[index].length));
+            spill->release(slots[index].offset, slots[index].length);
+            faultedIndex = index;
+            faults++;
+        }
+        return faulted;
+    }
+public:
+    DeltaHistory(size_t checkpointInterval = 64) : checkpointInterval(std::max<size_t>(1, checkpointInterval)), residentSegments(SIZE_MAX) {};
+    DeltaHistory(size_t checkpointInterval, size_t residentSegments, const std::string & spillPath)
+        : checkpointInterval(std::max<size_t>(1, checkpointInterval)), residentSegments(std::max<size_t>(1, residentSegments)),
+          spill(std::make_unique<SpillFile>(spillPath)) {};
+    ~DeltaHistory() { delete undone; }
+
+    void addState(CanvasMemento *newState) override {
+        const ShapeList &next = newState->shapes;
+        CanvasDelta delta;
+        delta.keep = latest.commonPrefix(next);
+        for (size_t i = delta.keep; i < latest.size(); i++) {
+            delta.removed.push_back(latest[i]);
+        }
+        for (size_t i = delta.keep; i < next.size(); i++) {
+            delta.added.push_back(next[i]);
+        }
+        if (stepCount % checkpointInterval == 0) {
+            segments.push_back({next, {}});
+        }
+        segments.back().deltas.push_back(std::move(delta));
+        segments.back().spilled = false;
+        stepCount++;
+        latest = next;
+        delete newState;
+        evictOldSegments();
+    }
+
+    CanvasMemento *undo() override {
+        if (stepCount == 0) {
+            return nullptr;
+        }
+        const CanvasDelta &delta = segments.back().deltas.back();
+        ShapeList previous = latest.take(delta.keep);
+        for (const auto &shape : delta.removed) {
+            previous = previous.push_back(shape);
+        }
+        segments.back().deltas.pop_back();
+        segments.back().spilled = false;
+        if (segments.back().deltas.empty()) {
+            segments.pop_back();
+            // Undo has reached a spilled segment: bring it back into memory.
+            if (!segments.empty() && firstResident == segments.size()) {
+                Segment &restored = segments.back();
+                const SpillSlot &slot = slots[segments.size() - 1];
+                Segment decoded = decode(spill->read(slot.offset, slot.length));
+                spill->release(slot.offset, slot.length);
+                restored.checkpoint = std::move(decoded.checkpoint);
+                restored.deltas = std::move(decoded.deltas);
+                firstResident--;
+                faults++;
+            }
+            if (faultedIndex >= firstResident) {
+                faultedIndex = SIZE_MAX;
+            }
+        }
+        stepCount--;
+        latest = previous;
+        delete undone;
+        undone = new CanvasMemento(latest);
+        return undone;
+    }
+
+    size_t steps() const { return stepCount; }
+    size_t interval() const { return checkpointInterval; }
+    size_t segmentFaults() const { return faults; }
+    size_t spilledBytes() const { return spill ? spill->size() : 0; }
+    ShapeList checkpointAt(size_t segment) { return segmentAt(segment).checkpoint; }
+    const CanvasDelta &deltaAt(size_t step) {
+        return segmentAt(step / checkpointInterval).deltas[step % checkpointInterval];
+    }
+};
+
+// Position in a DeltaHistory, and the canvas state at that position. The
+// state is kept as a prefix of the segment's checkpoint, shared rather than
+// copied, followed by the shapes the deltas since then have appended. Seeking
+// costs the deltas it applies, whatever the size of the state, and stepping
+// edits the appended shapes in place.
+class DeltaCursor {
+    DeltaHistory &history;
+    size_t step = 0;
+    bool started = false;
+    ShapeList checkpoint;
+    size_t shared = 0;
+    std::vector<ShapeId> appended;
+
+    void apply(size_t keep, const std::vector<ShapeId> &tail) {
+        if (keep < shared) {
+            shared = keep;
+            appended.clear();
+        } else {
+            appended.resize(std::min(appended.size(), keep - shared));
+        }
+        appended.insert(appended.end(), tail.begin(), tail.end());
+    }
+public:
+    DeltaCursor(DeltaHistory &history) : history(history) {};
+
+    // Rebuilds step `target` from the closest checkpoint at or before it.
+    void seek(size_t target) {
+        if (target >= history.steps()) {
+            throw std::out_of_range("DeltaCursor::seek: step " + std::to_string(target) + " of " + std::to_string(history.steps()));
+        }
+        const size_t segment = target / history.interval();
+        checkpoint = history.checkpointAt(segment);
+        shared = checkpoint.size();
+        appended.clear();
+        for (step = segment * history.interval(); step < target;) {
+            step++;
+            const CanvasDelta &delta = history.deltaAt(step);
+            apply(delta.keep, delta.added);
+        }
+        started = true;
+    }
+    bool next() {
+        if (!started) {
+            if (history.steps() == 0) {
+                return false;
+            }
+            seek(0);
+            return true;
+        }
+        if (step + 1 >= history.steps()) {
+            return false;
+        }
+        step++;
+        const CanvasDelta &delta = history.deltaAt(step);
+        apply(delta.keep, delta.added);
+        return true;
+    }
+    bool previous() {
+        if (!started || step == 0) {
+            return false;
+        }
+        const CanvasDelta &delta = history.deltaAt(step);
+        apply(delta.keep, delta.removed);
+        step--;
+        return true;
+    }
+
+    size_t size() const { return shared + appended.size(); }
+    template <typename Visit>
+    void forEach(Visit &&visit) const {
+        checkpoint.forEach(visit, shared);
+        for (ShapeId shape : appended) {
+            visit(shape);
+        }
+    }
+    ShapeList shapes() const {
+        ShapeList result = checkpoint.take(shared);
+        for (ShapeId shape : appended) {
+            result = result.push_back(shape);
+        }
+        return result;
+    }
+    size_t position() const { return step; }
+};
+
 class Canvas {
-    std::vector<std::string> shapes;
+    ShapeList shapes;
     History *history;
 public:
     Canvas(History *history) : history(history) {};
     void addShape(const std::string & newShape) {
-        shapes.push_back(newShape);
+        shapes = shapes.push_back(ShapeSymbols::instance().intern(newShape));
+        history->addState(new CanvasMemento(shapes));
+    };
+    void undo() {
+        if (CanvasMemento *previousState = history->undo()) {
+            shapes = previousState->shapes;
+        }
+    }
+    void clearAll() {
+        shapes = ShapeList();
+        history->addState(new CanvasMemento(shapes));
+    };
+    // Views into the symbol table, which outlives every canvas.
+    std::vector<std::string_view> getShapes() {
+        std::vector<std::string_view> names;
+        names.reserve(shapes.size());
+        shapes.forEach([&names](ShapeId shape) { names.push_back(shapeName(shape)); });
+        return names;
+    };
+};
+
+// Canvas that renderer threads can read while a single editor thread keeps
+// changing it. Each edit publishes a new immutable ShapeList with one atomic
+// exchange; a reader's snapshot is the pointer it loaded, taken in a fixed
+// number of steps without locks or retries.
+//
+// Replaced versions are freed with epoch-based reclamation. A reader announces
+// the global epoch in its slot before loading the current version and clears
+// the slot when its snapshot ends; the editor frees a version only once every
+// announced epoch is newer than the one it was retired in.
+class ConcurrentCanvas {
+    static constexpr uint64_t idle = UINT64_MAX;
+    static constexpr size_t maxReaders = 64;
+    static constexpr size_t reclaimBatch = 16;
+
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> epoch{idle};
+        std::atomic<bool> claimed{false};
+    };
+
+    ShapeList shapes;
+    History *history;
+    std::atomic<const ShapeList*> current;
+    std::atomic<uint64_t> globalEpoch{0};
+    ReaderSlot readers[maxReaders];
+    // Editor thread only.
+    std::vector<std::pair<uint64_t, const ShapeList*>> retired;
+
+    void publish() {
+        const ShapeList *old = current.exchange(new ShapeList(shapes));
+        retired.push_back({globalEpoch.fetch_add(1), old});
+        if (retired.size() >= reclaimBatch) {
+            reclaim();
+        }
+    }
+    void reclaim() {
+        uint64_t oldestActive = idle;
+        for (const auto &reader : readers) {
+            oldestActive = std::min(oldestActive, reader.epoch.load());
+        }
+        auto firstKept = std::partition(retired.begin(), retired.end(), [oldestActive](const auto &version) {
+            return version.first < oldestActive;
+        });
+        for (auto version = retired.begin(); version != firstKept; ++version) {
+            delete version->second;
+        }
+        retired.erase(retired.begin(), firstKept);
+    }
+public:
+    // A consistent view of the canvas; the version stays alive until the
+    // snapshot is destroyed. A reader holds at most one snapshot at a time.
+    class Snapshot {
+        friend class ConcurrentCanvas;
+        ReaderSlot *slot;
+        const ShapeList *version;
+        Snapshot(ReaderSlot *slot, const ShapeList *version) : slot(slot), version(version) {};
+    public:
+        Snapshot(Snapshot &&other) : slot(other.slot), version(other.version) { other.slot = nullptr; };
+        Snapshot(const Snapshot &) = delete;
+        Snapshot &operator=(const Snapshot &) = delete;
+        ~Snapshot() {
+            if (slot) {
+                slot->epoch.store(idle, std::memory_order_release);
+            }
+        }
+        const ShapeList &shapes() const { return *version; }
+        std::vector<std::string_view> getShapes() const {
+            std::vector<std::string_view> names;
+            names.reserve(version->size());
+            version->forEach([&names](ShapeId shape) { names.push_back(shapeName(shape)); });
+            return names;
+        }
+    };
+
+    ConcurrentCanvas(History *history) : history(history), current(new ShapeList()) {};
+    // Every reader must be finished before the canvas is destroyed.
+    ~ConcurrentCanvas() {
+        delete current.load();
+        for (const auto &version : retired) {
+            delete version.second;
+        }
+    }
+
+    // Editor thread.
+    void addShape(const std::string & newShape) {
+        shapes = shapes.push_back(ShapeSymbols::instance().intern(newShape));
         history->addState(new CanvasMemento(shapes));
+        publish();
     };
     void undo() {
         CanvasMemento *previousState = history->undo();
+        if (!previousState) {
+            return;
+        }
         shapes = previousState->shapes;
+        publish();
     }
     void clearAll() {
-        shapes.clear();
+        shapes = ShapeList();
         history->addState(new CanvasMemento(shapes));
+        publish();
     };
-    std::vector<std::string> getShapes() { return shapes; };
+
+    // Reader threads. addReader() returns a slot id, or throws when all
+    // maxReaders slots are taken.
+    size_t addReader() {
+        for (size_t i = 0; i < maxReaders; i++) {
+            bool expected = false;
+            if (readers[i].claimed.compare_exchange_strong(expected, true)) {
+                return i;
+            }
+        }
+        throw std::length_error("too many canvas readers");
+    }
+    void removeReader(size_t reader) {
+        readers[reader].claimed.store(false, std::memory_order_release);
+    }
+    Snapshot snapshot(size_t reader) {
+        ReaderSlot &slot = readers[reader];
+        slot.epoch.store(globalEpoch.load());
+        return Snapshot(&slot, current.load());
+    }
 };
 
 class ReplayCanvas {
-    std::vector<std::string> shapes;
+    ShapeList shapes;
     ForwardsIterator *historyIterator;
 public:
     ReplayCanvas(CanvasHistory *history) { historyIterator = history->getForwardsIterator(); };
@@ -109,14 +932,44 @@ public:
             CanvasMemento *nextState = historyIterator->next();
             shapes = nextState->shapes;
             std::cout << "The shapes are now: ";
-            for (auto shape : shapes) {
-                std::cout << shape << ", ";
-            }
+            shapes.forEach([](ShapeId shape) {
+                std::cout << shapeName(shape) << ", ";
+            });
             std::cout << "\n";
         }
     }
 };
 
+// Replays a DeltaHistory from any step, forwards or backwards.
+class SeekableReplayCanvas {
+    DeltaCursor cursor;
+
+    void show() {
+        std::cout << "Step " << cursor.position() << ", the shapes are now: ";
+        cursor.forEach([](ShapeId shape) {
+            std::cout << shapeName(shape) << ", ";
+        });
+        std::cout << "\n";
+    }
+public:
+    SeekableReplayCanvas(DeltaHistory &history) : cursor(history) {};
+    void seek(size_t step) {
+        cursor.seek(step);
+        show();
+    }
+    void replay() {
+        while (cursor.next()) {
+            show();
+        }
+    }
+    void replayBackwards() {
+        while (cursor.previous()) {
+            show();
+        }
+    }
+};
+
+#ifdef DEMO_MAIN
 int main(int argc, const char * argv[]) {
     NullHistory *history = new NullHistory;
     Canvas *canvas = new Canvas(history);
@@ -151,6 +1004,83 @@ int main(int argc, const char * argv[]) {
     };
     
     std::cout << "\n";
+    
+    DeltaHistory *deltaHistory = new DeltaHistory(2);
+    Canvas *deltaCanvas = new Canvas(deltaHistory);
+    deltaCanvas->addShape("rhombus");
+    deltaCanvas->addShape("triangle");
+    deltaCanvas->clearAll();
+    deltaCanvas->addShape("square");
+    deltaCanvas->addShape("circle");
+    deltaCanvas->undo();
+    
+    std::cout << "Replaying delta history:\n";
+    SeekableReplayCanvas seekable(*deltaHistory);
+    seekable.replay();
+    std::cout << "Backwards:\n";
+    seekable.replayBackwards();
+    std::cout << "Jumping to the end:\n";
+    seekable.seek(deltaHistory->steps() - 1);
+    
+    // Keeps one segment of two steps in memory and spills the rest.
+    DeltaHistory *boundedHistory = new DeltaHistory(2, 1, "canvas_history.spill");
+    Canvas *boundedCanvas = new Canvas(boundedHistory);
+    for (auto shape : {"rhombus", "triangle", "square", "circle", "hexagon"}) {
+        boundedCanvas->addShape(shape);
+    }
+    std::cout << "Replaying a spilled history:\n";
+    SeekableReplayCanvas spilled(*boundedHistory);
+    spilled.replay();
+    boundedCanvas->undo();
+    boundedCanvas->undo();
+    boundedCanvas->undo();
+    std::cout << "After undo, faulted in " << boundedHistory->segmentFaults() << " segments:\n";
+    for (auto shape : boundedCanvas->getShapes()) {
+        std::cout << shape << ", ";
+    }
+    std::cout << "\n";
+    
+    delete boundedCanvas;
+    delete boundedHistory;
+    
+    // One editor and two renderers sharing a canvas.
+    DeltaHistory *sharedHistory = new DeltaHistory();
+    ConcurrentCanvas *sharedCanvas = new ConcurrentCanvas(sharedHistory);
+    std::atomic<bool> editing{true};
+    std::vector<std::thread> renderers;
+    for (int i = 0; i < 2; i++) {
+        renderers.emplace_back([sharedCanvas, &editing] {
+            size_t reader = sharedCanvas->addReader();
+            while (editing.load()) {
+                ConcurrentCanvas::Snapshot frame = sharedCanvas->snapshot(reader);
+                frame.shapes().forEach([](ShapeId) {});
+            }
+            sharedCanvas->removeReader(reader);
+        });
+    }
+    for (int i = 0; i < 1000; i++) {
+        sharedCanvas->addShape(i % 3 == 0 ? "circle" : "square");
+        if (i % 7 == 6) {
+            sharedCanvas->undo();
+        }
+        if (i % 100 == 49) {
+            sharedCanvas->clearAll();
+        }
+    }
+    editing.store(false);
+    for (auto &renderer : renderers) {
+        renderer.join();
+    }
+    size_t reader = sharedCanvas->addReader();
+    std::cout << "Shared canvas ends with " << sharedCanvas->snapshot(reader).shapes().size() << " shapes\n";
+    sharedCanvas->removeReader(reader);
+    
+    delete sharedCanvas;
+    delete sharedHistory;
+    
+    delete deltaCanvas;
+    delete deltaHistory;
 
     return 0;
 }
+#endif
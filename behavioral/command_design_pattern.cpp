@@ -5,10 +5,39 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../common/async_log.h"
+#include "../common/block_pool.h"
+#include "../common/metrics.h"
 
 class Subscriber {
 public:
-    virtual void notify(const std::string & publisherName, const std::string & message) = 0;
+    virtual ~Subscriber() = default;
+    virtual void notify(const std::string & publisherName, std::string_view message) = 0;
+    virtual void notifyBatch(const std::string & publisherName, const std::vector<std::string_view> & messages) {
+        for (auto message : messages) {
+            notify(publisherName, message);
+        }
+    }
     virtual std::string getName() = 0;
 };
  
@@ -16,8 +45,8 @@ class ChatUser : public Subscriber {
     std::string userName;
 public:
     ChatUser(const std::string & userName) : userName(userName) {};
-    void notify(const std::string & publisherName, const std::string & message) override {
-        std::cout << userName << " received a new message from " << publisherName << ": " << message << "\n";
+    void notify(const std::string & publisherName, std::string_view message) override {
+        LOG_INFO(userName, " received a new message from ", publisherName, ": ", message);
     }
     std::string getName() override {
         return userName;
@@ -26,49 +55,352 @@ public:
  
 class Publisher {
 public:
+    virtual ~Publisher() = default;
     virtual void subscribe(Subscriber *subscriber) = 0;
     virtual void unsubscribe(Subscriber *subscriber) = 0;
-    virtual void publish(const std::string & message) = 0;
+    virtual void publish(std::string_view message) = 0;
 };
  
 class ChatGroup : public Publisher {
     std::string groupName;
     std::vector<Subscriber*> subscribers;
+    // Metrics slots of the group and, in step with subscribers, of each
+    // subscriber.
+    size_t metricsSlot;
+    std::vector<size_t> subscriberSlots;
 public:
-    ChatGroup(const std::string & groupName) : groupName(groupName) {};
+    ChatGroup(const std::string & groupName) : groupName(groupName), metricsSlot(Metrics::registerGroup(groupName)) {};
+    const std::string & getName() const { return groupName; }
     void subscribe(Subscriber *subscriber) {
         this->subscribers.push_back(subscriber);
+        subscriberSlots.push_back(Metrics::registerSubscriber(subscriber->getName()));
     }
     void unsubscribe(Subscriber *subscriber) {
-        subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(), [subscriber](Subscriber *s){ return s->getName() == subscriber->getName(); }), subscribers.end());
+        size_t kept = 0;
+        for (size_t i = 0; i < subscribers.size(); i++) {
+            if (subscribers[i]->getName() != subscriber->getName()) {
+                subscribers[kept] = subscribers[i];
+                subscriberSlots[kept] = subscriberSlots[i];
+                kept++;
+            }
+        }
+        subscribers.resize(kept);
+        subscriberSlots.resize(kept);
     }
-    void publish(const std::string & message) {
-        for (auto subscriber : subscribers) {
-            subscriber->notify(groupName, message);
+    void publish(std::string_view message) {
+        LapTimer timer;
+        Metrics::countFanout(metricsSlot, subscribers.size());
+        for (size_t i = 0; i < subscribers.size(); i++) {
+            subscribers[i]->notify(groupName, message);
+            timer.lapNotify(subscriberSlots[i]);
         }
+        timer.total(Metrics::Publish);
+    }
+    // Each subscriber's notifyBatch() counts as one notify event.
+    void publishBatch(const std::vector<std::string_view> & messages) {
+        LapTimer timer;
+        Metrics::countFanout(metricsSlot, subscribers.size() * messages.size());
+        for (size_t i = 0; i < subscribers.size(); i++) {
+            subscribers[i]->notifyBatch(groupName, messages);
+            timer.lapNotify(subscriberSlots[i]);
+        }
+        timer.total(Metrics::Publish);
     }
 };
 
+static constexpr size_t commandBlockSize = 64;
+
 class MessageCommand{
 public:
-    virtual ~MessageCommand();
+    virtual ~MessageCommand() {};
+    // Commands are created and destroyed per message, so they come from a pool
+    // rather than the global allocator.
+    static void *operator new(size_t size) {
+        return size <= commandBlockSize ? BlockPool<commandBlockSize>::allocate() : ::operator new(size);
+    }
+    static void operator delete(void *pointer, size_t size) {
+        if (size <= commandBlockSize) {
+            BlockPool<commandBlockSize>::deallocate(pointer);
+        } else {
+            ::operator delete(pointer);
+        }
+    }
     virtual void execute() = 0;
-    virtual std::string get_message() = 0;
+    virtual std::string_view get_message() = 0;
+    virtual ChatGroup *get_group() = 0;
+    // True when execute() only publishes get_message() to get_group(), so a
+    // run of such commands can be delivered with one publishBatch per group.
+    virtual bool onlyPublishes() const { return false; }
 };
 
 class SendMessageCommand: public MessageCommand{
 private:
-    std::string message;
     ChatGroup* group;
+    MessagePayload message;
 public:
-    SendMessageCommand(ChatGroup* group, std::string message): group(group), message(message){}
+    SendMessageCommand(ChatGroup* group, MessagePayload message): group(group), message(std::move(message)){}
     void execute() override{
-        group->publish(message);
+        StageTimer timer(Metrics::Execute);
+        group->publish(message.view());
+    }
+    std::string_view get_message() override{
+        return message.view();
+    }
+    ChatGroup *get_group() override{
+        return group;
+    }
+    bool onlyPublishes() const override{
+        return true;
+    }
+
+};
+
+// Append-only, memory-mapped log of sent messages. After a 16-byte header
+// (magic, committed length) each record is
+//     [u32 group name length][u32 message length][group name][message]
+// append() only copies into the mapping; commit() makes everything appended
+// since the previous commit durable with one msync, so callers that commit
+// once per batch share the cost across the whole batch. A record that was
+// appended but never committed is ignored when the log is reopened.
+class CommandLog {
+    static constexpr uint64_t magic = 0x31474f4c444d4d43; // "CMMDLOG1"
+    static constexpr size_t headerSize = 16;
+    static constexpr size_t initialCapacity = 1 << 20;
+
+    int fd = -1;
+    char *base = nullptr;
+    size_t capacity = 0;
+    size_t end = headerSize;
+    size_t committed = headerSize;
+    std::mutex mutex;
+
+    // Grows the file and maps it again. The old mapping is only released
+    // once the new one exists, so a failure leaves the log as it was.
+    void map(size_t newCapacity) {
+        if (ftruncate(fd, newCapacity) != 0) {
+            throw std::system_error(errno, std::generic_category(), "ftruncate");
+        }
+        void *mapping = mmap(nullptr, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        }
+        if (base) {
+            munmap(base, capacity);
+        }
+        base = static_cast<char*>(mapping);
+        capacity = newCapacity;
+    }
+    void sync(size_t from, size_t to) {
+        const size_t page = sysconf(_SC_PAGESIZE);
+        from -= from % page;
+        if (msync(base + from, to - from, MS_SYNC) != 0) {
+            throw std::system_error(errno, std::generic_category(), "msync");
+        }
+    }
+public:
+    // Opens the log at path, creating it if it does not exist. Throws rather
+    // than overwrite a non-empty file that is not a command log, or open a log
+    // whose header claims more than the file holds.
+    CommandLog(const std::string & path) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        }
+        try {
+            struct stat status;
+            if (fstat(fd, &status) != 0) {
+                throw std::system_error(errno, std::generic_category(), "fstat " + path);
+            }
+            const size_t fileSize = status.st_size;
+            uint64_t header[2] = {magic, headerSize};
+            if (fileSize != 0) {
+                if (fileSize < headerSize || pread(fd, header, headerSize, 0) != ssize_t(headerSize) || header[0] != magic) {
+                    throw std::runtime_error(path + " is not a command log");
+                }
+                if (header[1] < headerSize || header[1] > fileSize) {
+                    throw std::runtime_error(path + ": committed length " + std::to_string(header[1]) + " is outside the file");
+                }
+            }
+            map(std::max(fileSize, initialCapacity));
+            end = committed = header[1];
+            if (fileSize == 0) {
+                std::memcpy(base, header, headerSize);
+                sync(0, headerSize);
+            }
+        } catch (...) {
+            if (base) {
+                munmap(base, capacity);
+            }
+            close(fd);
+            throw;
+        }
+    }
+    // Commits what is left. A failure can only be logged here; call commit()
+    // first to handle it.
+    ~CommandLog() {
+        try {
+            commit();
+        } catch (const std::exception &error) {
+            LOG_ERROR("CommandLog: final commit failed: ", error.what());
+        }
+        munmap(base, capacity);
+        close(fd);
+    }
+
+    void append(std::string_view groupName, std::string_view message) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const uint32_t lengths[2] = {uint32_t(groupName.size()), uint32_t(message.size())};
+        const size_t recordSize = sizeof(lengths) + groupName.size() + message.size();
+        if (end + recordSize > capacity) {
+            map(std::max(capacity * 2, end + recordSize));
+        }
+        char *out = base + end;
+        std::memcpy(out, lengths, sizeof(lengths));
+        std::memcpy(out + sizeof(lengths), groupName.data(), groupName.size());
+        std::memcpy(out + sizeof(lengths) + groupName.size(), message.data(), message.size());
+        end += recordSize;
+    }
+
+    void commit() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (end == committed) {
+            return;
+        }
+        sync(committed, end);
+        const uint64_t newCommitted = end;
+        std::memcpy(base + sizeof(magic), &newCommitted, sizeof(newCommitted));
+        sync(0, headerSize);
+        committed = end;
+    }
+
+    // Calls apply(groupName, message) for every committed record, in order,
+    // with views straight into the mapping. Returns the number of records.
+    // Throws if a record runs past the committed end of the log.
+    template <typename Apply>
+    size_t replay(Apply &&apply) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t records = 0;
+        size_t offset = headerSize;
+        while (offset < committed) {
+            uint32_t lengths[2];
+            if (committed - offset < sizeof(lengths)) {
+                throw std::runtime_error("command log record at offset " + std::to_string(offset) + " is truncated");
+            }
+            std::memcpy(lengths, base + offset, sizeof(lengths));
+            if (committed - offset - sizeof(lengths) < size_t(lengths[0]) + lengths[1]) {
+                throw std::runtime_error("command log record at offset " + std::to_string(offset) + " is truncated");
+            }
+            const char *groupName = base + offset + sizeof(lengths);
+            apply(std::string_view(groupName, lengths[0]), std::string_view(groupName + lengths[0], lengths[1]));
+            offset += sizeof(lengths) + lengths[0] + lengths[1];
+            records++;
+        }
+        return records;
+    }
+};
+
+// Per-message outcome of a compiled pipeline. Mirrors the strings returned by
+// the handler chain without allocating one for every message.
+enum class ValidationResult : unsigned char { Pending, Success, Sent, Empty, TooShort };
+
+// A message's result plus, when it failed, the index of the stage that
+// rejected it, so the reply can name that stage's limit.
+struct ValidationOutcome {
+    ValidationResult result;
+    unsigned char stage;
+};
+
+// Flat form of a configured handler chain. Each check runs as one pass over the
+// message lengths of a whole batch instead of one virtual hop per stage per
+// message; the first failing stage decides a message's result.
+class ValidationPipeline {
+    struct Stage {
+        size_t minLength;
+        ValidationResult failure;
+    };
+    static constexpr size_t maxStages = 255;
+    std::vector<Stage> stages;
+    std::vector<size_t> lengths;
+    bool posts = false;
+    CommandLog *log = nullptr;
+public:
+    void requireMinLength(size_t minLength, ValidationResult failure) {
+        if (stages.size() == maxStages) {
+            throw std::length_error("too many validation stages");
+        }
+        stages.push_back({minLength, failure});
+    }
+    void postOnSuccess(CommandLog *commandLog) {
+        posts = true;
+        log = commandLog;
+    }
+    bool postsOnSuccess() const { return posts; }
+    // Write-ahead logging for accepted commands: record() each one, then
+    // commitLog() once for the batch before executing any of them.
+    void record(MessageCommand *command) {
+        if (log) {
+            log->append(command->get_group()->getName(), command->get_message());
+        }
+    }
+    void commitLog() {
+        if (log) {
+            log->commit();
+        }
+    }
+
+    void validate(const std::vector<MessageCommand*> &batch, std::vector<ValidationOutcome> &results) {
+        const size_t count = batch.size();
+        lengths.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            lengths[i] = batch[i]->get_message().length();
+        }
+        results.assign(count, {ValidationResult::Pending, 0});
+        const size_t *length = lengths.data();
+        ValidationOutcome *result = results.data();
+        for (size_t index = 0; index < stages.size(); index++) {
+            const Stage stage = stages[index];
+            const unsigned char stageIndex = index;
+            // Branch-free so the compiler can vectorize the pass.
+            for (size_t i = 0; i < count; i++) {
+                bool fails = result[i].result == ValidationResult::Pending && length[i] < stage.minLength;
+                result[i].result = fails ? stage.failure : result[i].result;
+                result[i].stage = fails ? stageIndex : result[i].stage;
+            }
+        }
     }
-    std::string get_message() override{
-        return message;
+
+    void run(const std::vector<MessageCommand*> &batch, std::vector<ValidationOutcome> &results) {
+        validate(batch, results);
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (posts && results[i].result == ValidationResult::Pending) {
+                record(batch[i]);
+            }
+        }
+        commitLog();
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (results[i].result != ValidationResult::Pending) {
+                continue;
+            }
+            if (posts) {
+                batch[i]->execute();
+            }
+            results[i].result = posts ? ValidationResult::Sent : ValidationResult::Success;
+        }
     }
 
+    std::string describe(const ValidationOutcome &outcome) const {
+        switch (outcome.result) {
+        case ValidationResult::Sent:
+            return "Message Sent!";
+        case ValidationResult::Empty:
+            return "Please enter a value";
+        case ValidationResult::TooShort:
+            return "Please enter a value longer than " + std::to_string(stages[outcome.stage].minLength);
+        default:
+            break;
+        }
+        return "Success!";
+    }
 };
 
 class Handler {
@@ -76,15 +408,23 @@ public:
     virtual Handler *setNext(Handler *nextValidator) = 0;
     virtual ~Handler() {};
     virtual std::string handle(MessageCommand *command) = 0;
+    virtual void compileInto(ValidationPipeline &pipeline) = 0;
+    ValidationPipeline compile() {
+        ValidationPipeline pipeline;
+        compileInto(pipeline);
+        return pipeline;
+    }
 };
 
 class BaseHandler : public Handler {
 protected:
-    Handler *next = nullptr;
+    // Each handler owns its successor, so deleting the head of a chain frees
+    // the whole chain.
+    std::unique_ptr<Handler> next;
 public:
-    ~BaseHandler() { delete next; };
+    // Takes ownership of nextValidator; a previously set successor is freed.
     Handler *setNext(Handler *nextValidator) override {
-        next = nextValidator;
+        next.reset(nextValidator);
         return nextValidator;
     }
     virtual std::string handle(MessageCommand *command) override {
@@ -93,19 +433,30 @@ public:
         }
         return "Success!";
     }
+    virtual void compileInto(ValidationPipeline &pipeline) override {
+        if (this->next) {
+            this->next->compileInto(pipeline);
+        }
+    }
 };
 
 class NotEmptyValidator: public BaseHandler {
 public:
     std::string handle(MessageCommand *command) override {
-        std::cout << "Checking if empty...\n";
+        LOG_DEBUG("Checking if empty...");
         
+        StageTimer timer(Metrics::Validate);
         if (command->get_message().empty()) {
             return "Please enter a value";
         }
+        timer.stop();
         
         return BaseHandler::handle(command);
     }
+    void compileInto(ValidationPipeline &pipeline) override {
+        pipeline.requireMinLength(1, ValidationResult::Empty);
+        BaseHandler::compileInto(pipeline);
+    }
 };
 
 class LengthValidator: public BaseHandler {
@@ -113,24 +464,232 @@ class LengthValidator: public BaseHandler {
 public:
     LengthValidator(int minLength) : minLength(minLength) {};
     std::string handle(MessageCommand *command) override {
-        std::cout << "Checking if length equals" << minLength << "...\n";
+        LOG_DEBUG("Checking if length equals", minLength, "...");
         
+        StageTimer timer(Metrics::Validate);
         if (command->get_message().length() < minLength) {
             return "Please enter a value longer than " + std::to_string(minLength);
         }
+        timer.stop();
         
         return BaseHandler::handle(command);
     }
+    void compileInto(ValidationPipeline &pipeline) override {
+        pipeline.requireMinLength(minLength, ValidationResult::TooShort);
+        BaseHandler::compileInto(pipeline);
+    }
 };
 
 class PostMessageHandler: public BaseHandler {
+    CommandLog *log;
 public:
+    // With a log, every message is made durable before it is published.
+    PostMessageHandler(CommandLog *log = nullptr) : log(log) {};
     std::string handle(MessageCommand *command) {
+        if (log) {
+            log->append(command->get_group()->getName(), command->get_message());
+            log->commit();
+        }
         command->execute();
         return "Message Sent!";
     }
+    void compileInto(ValidationPipeline &pipeline) override {
+        pipeline.postOnSuccess(log);
+    }
+};
+
+struct ExecutorConfig {
+    // A batch is handed on once it holds this many commands...
+    size_t maxBatchSize = 256;
+    // ...or once its oldest command has waited this long, whichever is first.
+    std::chrono::microseconds maxLatency{200};
+};
+
+// Accepts commands from any number of producer threads and runs them in
+// group-committed batches, with the same outcome as handle() on the chain the
+// executor was built from. A validation stage checks each batch with the
+// compiled pipeline and logs the survivors; if the chain posts, a delivery
+// stage then executes them in order, publishing each run of publish-only
+// commands with one subscriber pass per group. Each stage has its own thread,
+// so one batch is delivered while the next is being validated. The executor
+// owns submitted commands and deletes them when done.
+//
+// Execution and delivery are one stage on purpose. A chat command's execute()
+// is its publish, so a separate execution thread would either hand the same
+// commands on to delivery unchanged, or run commands that are not publish-only
+// out of order with the batched publishes around them. The cost is that a
+// slow subscriber holds up the commands behind it; validation and logging of
+// later batches carry on meanwhile, up to maxValidatedBatches ahead.
+class CommandExecutor {
+    struct Submitted {
+        MessageCommand *command;
+        std::chrono::steady_clock::time_point at;
+    };
+    struct GroupBatch {
+        ChatGroup *group;
+        std::vector<std::string_view> messages;
+    };
+    struct ValidatedBatch {
+        std::vector<MessageCommand*> commands;
+        std::vector<MessageCommand*> accepted;
+    };
+    static constexpr size_t maxValidatedBatches = 2;
+
+    ValidationPipeline pipeline;
+    ExecutorConfig config;
+
+    std::mutex submitMutex;
+    std::condition_variable submitReady;
+    std::deque<Submitted> pending;
+    bool stopping = false;
+
+    std::mutex deliveryMutex;
+    std::condition_variable deliveryReady;
+    std::deque<ValidatedBatch> validated;
+    bool validationDone = false;
+
+    std::atomic<size_t> delivered{0};
+    std::atomic<size_t> rejected{0};
+    std::thread validationThread;
+    std::thread deliveryThread;
+
+    void validationLoop() {
+        std::vector<MessageCommand*> batch;
+        std::vector<ValidationOutcome> results;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(submitMutex);
+                submitReady.wait(lock, [this] { return stopping || !pending.empty(); });
+                if (pending.empty()) {
+                    break;
+                }
+                // The batch is due maxLatency after its oldest command was
+                // submitted, however long this thread took to notice it.
+                const auto deadline = pending.front().at + config.maxLatency;
+                submitReady.wait_until(lock, deadline, [this] { return stopping || pending.size() >= config.maxBatchSize; });
+                const size_t count = std::min(pending.size(), config.maxBatchSize);
+                batch.clear();
+                for (size_t i = 0; i < count; i++) {
+                    batch.push_back(pending[i].command);
+                }
+                pending.erase(pending.begin(), pending.begin() + count);
+            }
+
+            pipeline.validate(batch, results);
+            ValidatedBatch out;
+            size_t failed = 0;
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (results[i].result != ValidationResult::Pending) {
+                    failed++;
+                } else if (pipeline.postsOnSuccess()) {
+                    pipeline.record(batch[i]);
+                    out.accepted.push_back(batch[i]);
+                }
+            }
+            pipeline.commitLog();
+            rejected += failed;
+            out.commands = batch;
+
+            std::unique_lock<std::mutex> lock(deliveryMutex);
+            deliveryReady.wait(lock, [this] { return validated.size() < maxValidatedBatches; });
+            validated.push_back(std::move(out));
+            deliveryReady.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(deliveryMutex);
+        validationDone = true;
+        deliveryReady.notify_all();
+    }
+
+    // Executes accepted commands in submission order. Consecutive publish-only
+    // commands are gathered per group and published together.
+    void deliver(const std::vector<MessageCommand*> &accepted) {
+        std::vector<GroupBatch> groups;
+        std::unordered_map<ChatGroup*, size_t> groupIndex;
+        size_t i = 0;
+        while (i < accepted.size()) {
+            if (!accepted[i]->onlyPublishes()) {
+                accepted[i++]->execute();
+                delivered++;
+                continue;
+            }
+            groups.clear();
+            groupIndex.clear();
+            for (; i < accepted.size() && accepted[i]->onlyPublishes(); i++) {
+                ChatGroup *group = accepted[i]->get_group();
+                auto found = groupIndex.emplace(group, groups.size());
+                if (found.second) {
+                    groups.push_back({group, {}});
+                }
+                groups[found.first->second].messages.push_back(accepted[i]->get_message());
+            }
+            for (auto &groupBatch : groups) {
+                groupBatch.group->publishBatch(groupBatch.messages);
+                delivered += groupBatch.messages.size();
+            }
+        }
+    }
+
+    void deliveryLoop() {
+        while (true) {
+            ValidatedBatch batch;
+            {
+                std::unique_lock<std::mutex> lock(deliveryMutex);
+                deliveryReady.wait(lock, [this] { return validationDone || !validated.empty(); });
+                if (validated.empty()) {
+                    break;
+                }
+                batch = std::move(validated.front());
+                validated.pop_front();
+                deliveryReady.notify_all();
+            }
+            deliver(batch.accepted);
+            for (auto command : batch.commands) {
+                delete command;
+            }
+        }
+    }
+public:
+    CommandExecutor(Handler *chain, ExecutorConfig config = {}) : pipeline(chain->compile()), config(config) {
+        validationThread = std::thread(&CommandExecutor::validationLoop, this);
+        deliveryThread = std::thread(&CommandExecutor::deliveryLoop, this);
+    }
+    ~CommandExecutor() { shutdown(); }
+
+    // Takes ownership of the command and returns true. After shutdown() it
+    // returns false instead and the command stays with the caller, since no
+    // stage is left to run it.
+    bool submit(MessageCommand *command) {
+        std::lock_guard<std::mutex> lock(submitMutex);
+        if (stopping) {
+            return false;
+        }
+        pending.push_back({command, std::chrono::steady_clock::now()});
+        if (pending.size() == 1 || pending.size() >= config.maxBatchSize) {
+            submitReady.notify_one();
+        }
+        return true;
+    }
+
+    // Runs everything already submitted, then stops both stages.
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(submitMutex);
+            stopping = true;
+            submitReady.notify_one();
+        }
+        if (validationThread.joinable()) {
+            validationThread.join();
+        }
+        if (deliveryThread.joinable()) {
+            deliveryThread.join();
+        }
+    }
+
+    size_t deliveredCount() const { return delivered; }
+    size_t rejectedCount() const { return rejected; }
 };
 
+#ifdef DEMO_MAIN
 int main(int argc, const char * argv[]) {
     ChatUser *user1 = new ChatUser("Jim");
     ChatUser *user2 = new ChatUser("Barb");
@@ -145,27 +704,89 @@ int main(int argc, const char * argv[]) {
     group2->subscribe(user2);
     group2->subscribe(user3);
     
+    // Given a log file, replay the messages sent by earlier runs and keep
+    // logging new ones to it.
+    CommandLog *commandLog = nullptr;
+    if (argc > 1) {
+        commandLog = new CommandLog(argv[1]);
+        std::unordered_map<std::string_view, ChatGroup*> groupsByName{
+            {group1->getName(), group1},
+            {group2->getName(), group2}
+        };
+        std::cout << "Replaying " << argv[1] << ":\n";
+        size_t replayed = commandLog->replay([&](std::string_view groupName, std::string_view message) {
+            auto group = groupsByName.find(groupName);
+            if (group != groupsByName.end()) {
+                group->second->publish(message);
+            }
+        });
+        asynclog::flush();
+        std::cout << replayed << " messages replayed\n\n";
+    }
+    
     Handler *sendMessageChain = new BaseHandler;
     
     sendMessageChain
         ->setNext(new NotEmptyValidator)
         ->setNext(new LengthValidator(2))
-        ->setNext(new PostMessageHandler);
+        ->setNext(new PostMessageHandler(commandLog));
     
     SendMessageCommand *emptyMessage = new SendMessageCommand(group1, "");
     SendMessageCommand *tooShortMessage = new SendMessageCommand(group1, "H");
     SendMessageCommand *sayHelloToGroup1 = new SendMessageCommand(group1, "Hello everyone in group 1!");
     SendMessageCommand *sayHelloToGroup2 = new SendMessageCommand(group2, "Hello everyone in group 2!");
     
-    std::cout << "Sending empty message:\n" << sendMessageChain->handle(emptyMessage) << "\n\n";
-    std::cout << "Sending short message:\n" << sendMessageChain->handle(tooShortMessage) << "\n\n";
-    std::cout << "Sending message to group 1:\n" << sendMessageChain->handle(sayHelloToGroup1) << "\n\n";
-    std::cout << "Sending message to group 2:\n" << sendMessageChain->handle(sayHelloToGroup2) << "\n\n";
+    // The handlers log asynchronously; flush so their lines come before the reply.
+    auto send = [&](const char *description, MessageCommand *command) {
+        std::cout << description;
+        std::string reply = sendMessageChain->handle(command);
+        asynclog::flush();
+        std::cout << reply << "\n\n";
+    };
+    send("Sending empty message:\n", emptyMessage);
+    send("Sending short message:\n", tooShortMessage);
+    send("Sending message to group 1:\n", sayHelloToGroup1);
+    send("Sending message to group 2:\n", sayHelloToGroup2);
+
+    ValidationPipeline sendMessagePipeline = sendMessageChain->compile();
+    std::vector<MessageCommand*> batch{emptyMessage, tooShortMessage, sayHelloToGroup1, sayHelloToGroup2};
+    std::vector<ValidationOutcome> results;
+    std::cout << "Sending batch:\n";
+    sendMessagePipeline.run(batch, results);
+    asynclog::flush();
+    for (auto result : results) {
+        std::cout << sendMessagePipeline.describe(result) << "\n";
+    }
+    std::cout << "\n";
+
+    std::cout << "Sending through the executor:\n";
+    {
+        CommandExecutor executor(sendMessageChain, {64, std::chrono::microseconds(500)});
+        std::thread producer1([&] {
+            executor.submit(new SendMessageCommand(group1, "Tomatoes are in!"));
+            executor.submit(new SendMessageCommand(group1, "?"));
+        });
+        std::thread producer2([&] {
+            executor.submit(new SendMessageCommand(group2, "Walk at noon?"));
+            executor.submit(new SendMessageCommand(group2, "Bring treats."));
+        });
+        producer1.join();
+        producer2.join();
+        executor.shutdown();
+        asynclog::flush();
+        std::cout << executor.deliveredCount() << " delivered, " << executor.rejectedCount() << " rejected\n\n";
+    }
     
     delete user1;
     delete user2;
     delete user3;
     delete group1;
     delete group2;
+    delete emptyMessage;
+    delete tooShortMessage;
+    delete sayHelloToGroup1;
+    delete sayHelloToGroup2;
     delete sendMessageChain;
-}
\ No newline at end of file
+    delete commandLog;
+}
+#endif
@@ -0,0 +1,444 @@
+/*
+ * Benchmark runner. Times every registered case and reports, per operation,
+ * wall time, heap allocations and (where the kernel allows it) hardware
+ * counters, as a table or as JSON for regression tracking.
+ *
+ *     <pattern>_bench [--filter=<substring>] [--min-time=<seconds>]
+ *                     [--format=text|json] [--show-output] [--list] [--large]
+ *
+ * Cases marked large (gigabytes of disk or memory) only run with --large or
+ * BENCH_LARGE=1 in the environment.
+ *
+ * Pattern code writes to stdout on its hot paths; unless --show-output is
+ * given, stdout is pointed at /dev/null while cases run and the report goes
+ * to the original stdout.
+ */
+
+#include "bench.h"
+#include "common/async_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// Every operator new in the program goes through here so cases can report
+// allocations per operation. Sizes are the allocator's usable sizes, which
+// also lets operator delete keep a count of live bytes.
+namespace {
+
+std::atomic<uint64_t> allocationCount{0};
+std::atomic<uint64_t> allocatedBytes{0};
+std::atomic<int64_t> liveBytes{0};
+
+void *countedAllocate(size_t size, size_t alignment) {
+    void *pointer = alignment <= alignof(std::max_align_t)
+        ? std::malloc(size ? size : 1)
+        : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (!pointer) {
+        return nullptr;
+    }
+    const size_t usable = malloc_usable_size(pointer);
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(usable, std::memory_order_relaxed);
+    liveBytes.fetch_add(usable, std::memory_order_relaxed);
+    return pointer;
+}
+
+void *allocateOrThrow(size_t size, size_t alignment) {
+    void *pointer = countedAllocate(size, alignment);
+    if (!pointer) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void countedFree(void *pointer) {
+    if (pointer) {
+        liveBytes.fetch_sub(malloc_usable_size(pointer), std::memory_order_relaxed);
+        std::free(pointer);
+    }
+}
+
+}
+
+void *operator new(size_t size) { return allocateOrThrow(size, 0); }
+void *operator new[](size_t size) { return allocateOrThrow(size, 0); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return countedAllocate(size, 0); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return countedAllocate(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment) { return allocateOrThrow(size, size_t(alignment)); }
+void *operator new[](size_t size, std::align_val_t alignment) { return allocateOrThrow(size, size_t(alignment)); }
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept { return countedAllocate(size, size_t(alignment)); }
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept { return countedAllocate(size, size_t(alignment)); }
+void operator delete(void *pointer) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer) noexcept { countedFree(pointer); }
+void operator delete(void *pointer, size_t) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { countedFree(pointer); }
+void operator delete(void *pointer, const std::nothrow_t &) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept { countedFree(pointer); }
+void operator delete(void *pointer, std::align_val_t) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer, std::align_val_t) noexcept { countedFree(pointer); }
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept { countedFree(pointer); }
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t &) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t &) noexcept { countedFree(pointer); }
+
+namespace {
+std::atomic<uint64_t> countedBytes{0};
+}
+
+void bench::countBytes(size_t bytes) {
+    countedBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+int bench::nullFd() {
+    static const int fd = open("/dev/null", O_WRONLY);
+    return fd;
+}
+
+namespace {
+
+// Hardware counters for the calling thread and every thread it starts, read
+// through perf_event_open. Counters the kernel refuses (no PMU in a VM,
+// perf_event_paranoid, non-Linux hosts) are reported as unavailable.
+class PerfCounters {
+public:
+    static constexpr size_t count = 4;
+    static constexpr const char *names[count] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+private:
+    int fds[count] = {-1, -1, -1, -1};
+public:
+    PerfCounters() {
+#ifdef __linux__
+        static const uint64_t configs[count] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+        for (size_t i = 0; i < count; i++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[i] = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+    ~PerfCounters() {
+        for (int fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+    bool available() const {
+        return std::any_of(std::begin(fds), std::end(fds), [](int fd) { return fd >= 0; });
+    }
+    void start() {
+#ifdef __linux__
+        for (int fd : fds) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+    // Counts since start(), scaled up when the kernel had to multiplex; NaN
+    // for counters that are not available.
+    void stop(double (&values)[count]) {
+        for (size_t i = 0; i < count; i++) {
+            values[i] = NAN;
+#ifdef __linux__
+            if (fds[i] < 0) {
+                continue;
+            }
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t reading[3];
+            if (read(fds[i], reading, sizeof(reading)) == sizeof(reading) && reading[2] > 0) {
+                values[i] = double(reading[0]) * double(reading[1]) / double(reading[2]);
+            }
+#endif
+        }
+    }
+};
+
+// Resident set size of the process in KiB, from /proc/self/status; -1 where
+// that is unavailable. Unlike the heap counters this includes mmap'd files
+// and memory pools hold on to.
+long residentKb(const char *field) {
+    FILE *status = std::fopen("/proc/self/status", "r");
+    if (!status) {
+        return -1;
+    }
+    long value = -1;
+    char line[256];
+    const size_t length = std::strlen(field);
+    while (std::fgets(line, sizeof(line), status)) {
+        if (std::strncmp(line, field, length) == 0 && line[length] == ':') {
+            value = std::atol(line + length + 1);
+            break;
+        }
+    }
+    std::fclose(status);
+    return value;
+}
+
+// Resets VmHWM to the current RSS so each case reports its own peak.
+void resetPeakResident() {
+    FILE *clear = std::fopen("/proc/self/clear_refs", "w");
+    if (clear) {
+        std::fputs("5", clear);
+        std::fclose(clear);
+    }
+}
+
+struct Result {
+    std::string name;
+    size_t iterations = 0;
+    size_t ops = 0;
+    double seconds = 0;
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    int64_t retained = 0;
+    uint64_t processed = 0;
+    long rssGrowthKb = -1;
+    long peakRssKb = -1;
+    double counters[PerfCounters::count];
+};
+
+Result measure(const bench::Case &c, size_t iterations, PerfCounters &perf) {
+    Result result;
+    result.name = c.name;
+    result.iterations = iterations;
+    result.ops = iterations * c.opsPerIteration;
+
+    resetPeakResident();
+    bench::Loop loop = c.prepare();
+    const long rssBefore = residentKb("VmRSS");
+    const uint64_t allocationsBefore = allocationCount.load();
+    const uint64_t bytesBefore = allocatedBytes.load();
+    const int64_t liveBefore = liveBytes.load();
+    const uint64_t processedBefore = countedBytes.load();
+    perf.start();
+    const auto start = std::chrono::steady_clock::now();
+    loop(iterations);
+    const auto end = std::chrono::steady_clock::now();
+    perf.stop(result.counters);
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    result.allocations = allocationCount.load() - allocationsBefore;
+    result.bytes = allocatedBytes.load() - bytesBefore;
+    // Heap still held by the fixture once the loop is done, e.g. the
+    // mementos a history keeps.
+    result.retained = liveBytes.load() - liveBefore;
+    result.processed = countedBytes.load() - processedBefore;
+    // Memory is reported for the whole run rather than per operation: the
+    // growth across the loop and the peak including the fixture.
+    const long rssAfter = residentKb("VmRSS");
+    if (rssBefore >= 0 && rssAfter >= 0) {
+        result.rssGrowthKb = rssAfter - rssBefore;
+    }
+    result.peakRssKb = residentKb("VmHWM");
+    // Hand the fixture's freed heap back to the kernel, or the next case
+    // reuses it without its RSS growing and looks smaller than it is.
+    loop = nullptr;
+    malloc_trim(0);
+    return result;
+}
+
+// Doubles (or more) the iteration count until a run lasts at least minTime.
+Result run(const bench::Case &c, double minTime, PerfCounters &perf) {
+    size_t iterations = c.fixedIterations ? c.fixedIterations : 1;
+    Result result = measure(c, iterations, perf);
+    while (!c.fixedIterations && result.seconds < minTime && iterations < (size_t(1) << 40)) {
+        const double scale = result.seconds > 0 ? minTime * 1.2 / result.seconds : 100;
+        iterations = size_t(double(iterations) * std::clamp(scale, 1.5, 100.0)) + 1;
+        result = measure(c, iterations, perf);
+    }
+    return result;
+}
+
+void printNumber(FILE *out, double value, bool json) {
+    if (std::isnan(value)) {
+        std::fputs(json ? "null" : "-", out);
+    } else {
+        std::fprintf(out, json ? "%.6g" : "%.4g", value);
+    }
+}
+
+void writeText(FILE *out, const std::vector<Result> &results) {
+    size_t width = 4;
+    for (const auto &result : results) {
+        width = std::max(width, result.name.size());
+    }
+    std::fprintf(out, "%-*s %12s %10s %10s %12s %10s %10s %10s", int(width), "case", "ns/op", "allocs/op", "bytes/op", "retained/op",
+        "rss+ kB", "peak kB", "MB/s");
+    for (const char *name : PerfCounters::names) {
+        std::fprintf(out, " %13s", (std::string(name) + "/op").c_str());
+    }
+    std::fputc('\n', out);
+    for (const auto &result : results) {
+        const double ops = double(result.ops);
+        std::fprintf(out, "%-*s %12.1f %10.3g %10.4g %12.4g", int(width), result.name.c_str(),
+            result.seconds * 1e9 / ops, result.allocations / ops, result.bytes / ops, result.retained / ops);
+        if (result.peakRssKb < 0) {
+            std::fprintf(out, " %10s %10s", "-", "-");
+        } else {
+            std::fprintf(out, " %10ld %10ld", result.rssGrowthKb, result.peakRssKb);
+        }
+        if (result.processed) {
+            std::fprintf(out, " %10.1f", result.processed / result.seconds / 1e6);
+        } else {
+            std::fprintf(out, " %10s", "-");
+        }
+        for (double counter : result.counters) {
+            std::fputc(' ', out);
+            char cell[32];
+            if (std::isnan(counter)) {
+                std::snprintf(cell, sizeof(cell), "%13s", "-");
+            } else {
+                std::snprintf(cell, sizeof(cell), "%13.4g", counter / ops);
+            }
+            std::fputs(cell, out);
+        }
+        std::fputc('\n', out);
+    }
+}
+
+void writeJsonString(FILE *out, const std::string &text) {
+    std::fputc('"', out);
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            std::fputc('\\', out);
+        }
+        std::fputc(c, out);
+    }
+    std::fputc('"', out);
+}
+
+void writeJson(FILE *out, const std::vector<Result> &results, double minTime, bool perfAvailable) {
+    std::fprintf(out, "{\n  \"context\": {\"cpus\": %u, \"min_time_s\": %g, \"perf_counters\": %s},\n  \"benchmarks\": [",
+        std::thread::hardware_concurrency(), minTime, perfAvailable ? "true" : "false");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        const double ops = double(result.ops);
+        std::fputs(i ? ",\n    {\"name\": " : "\n    {\"name\": ", out);
+        writeJsonString(out, result.name);
+        std::fprintf(out, ", \"iterations\": %zu, \"ops\": %zu, \"ns_per_op\": ", result.iterations, result.ops);
+        printNumber(out, result.seconds * 1e9 / ops, true);
+        std::fputs(", \"allocs_per_op\": ", out);
+        printNumber(out, result.allocations / ops, true);
+        std::fputs(", \"bytes_per_op\": ", out);
+        printNumber(out, result.bytes / ops, true);
+        std::fputs(", \"retained_bytes_per_op\": ", out);
+        printNumber(out, result.retained / ops, true);
+        std::fputs(", \"rss_growth_kb\": ", out);
+        printNumber(out, result.peakRssKb < 0 ? NAN : double(result.rssGrowthKb), true);
+        std::fputs(", \"peak_rss_kb\": ", out);
+        printNumber(out, result.peakRssKb < 0 ? NAN : double(result.peakRssKb), true);
+        std::fputs(", \"mb_per_s\": ", out);
+        printNumber(out, result.processed ? result.processed / result.seconds / 1e6 : NAN, true);
+        for (size_t counter = 0; counter < PerfCounters::count; counter++) {
+            std::fprintf(out, ", \"%s_per_op\": ", PerfCounters::names[counter]);
+            printNumber(out, result.counters[counter] / ops, true);
+        }
+        std::fputc('}', out);
+    }
+    std::fputs("\n  ]\n}\n", out);
+}
+
+bool option(const char *argument, const char *name, std::string &value) {
+    const size_t length = std::strlen(name);
+    if (std::strncmp(argument, name, length) != 0 || argument[length] != '=') {
+        return false;
+    }
+    value = argument + length + 1;
+    return true;
+}
+
+}
+
+int main(int argc, const char * argv[]) {
+    std::string filter;
+    std::string format = "text";
+    std::string value;
+    double minTime = 0.2;
+    bool list = false;
+    bool showOutput = false;
+    const char *largeEnv = std::getenv("BENCH_LARGE");
+    bool large = largeEnv && std::strcmp(largeEnv, "0") != 0;
+    for (int i = 1; i < argc; i++) {
+        if (option(argv[i], "--filter", value)) {
+            filter = value;
+        } else if (option(argv[i], "--min-time", value)) {
+            minTime = std::atof(value.c_str());
+        } else if (option(argv[i], "--format", value) && (value == "text" || value == "json")) {
+            format = value;
+        } else if (std::strcmp(argv[i], "--list") == 0) {
+            list = true;
+        } else if (std::strcmp(argv[i], "--show-output") == 0) {
+            showOutput = true;
+        } else if (std::strcmp(argv[i], "--large") == 0) {
+            large = true;
+        } else {
+            std::fprintf(stderr, "usage: %s [--filter=<substring>] [--min-time=<seconds>] [--format=text|json] [--show-output] [--list] [--large]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<const bench::Case*> selected;
+    for (const auto &c : bench::registry()) {
+        if (c.name.find(filter) != std::string::npos && (large || !c.large)) {
+            selected.push_back(&c);
+        }
+    }
+    std::sort(selected.begin(), selected.end(), [](const bench::Case *a, const bench::Case *b) { return a->name < b->name; });
+    if (list) {
+        for (auto c : selected) {
+            std::printf("%s\n", c->name.c_str());
+        }
+        return 0;
+    }
+
+    std::fflush(stdout);
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!showOutput) {
+        dup2(bench::nullFd(), STDOUT_FILENO);
+    }
+
+    PerfCounters perf;
+    std::vector<Result> results;
+    for (auto c : selected) {
+        results.push_back(run(*c, minTime, perf));
+        std::cout.flush();
+        asynclog::flush();
+    }
+    if (format == "json") {
+        writeJson(report, results, minTime, perf.available());
+    } else {
+        writeText(report, results);
+    }
+    std::fclose(report);
+    return 0;
+}
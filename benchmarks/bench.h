@@ -0,0 +1,67 @@
+/*
+ * Minimal benchmark harness shared by every pattern benchmark. Each
+ * benchmark file registers its cases with bench::Register; bench.cpp
+ * times them and reports ns/op, allocations/op, resident memory and
+ * hardware counters.
+ */
+
+#ifndef DESIGN_PATTERNS_BENCH_H
+#define DESIGN_PATTERNS_BENCH_H
+
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+// The timed part of a case: performs the operation `iterations` times.
+using Loop = std::function<void(size_t iterations)>;
+
+struct Case {
+    std::string name;
+    // Builds the fixture outside the timed region and returns the loop to
+    // time. The fixture is destroyed when the returned loop is.
+    std::function<Loop()> prepare;
+    // Operations done by one loop iteration; results are reported per
+    // operation, so batched cases stay comparable with single-item ones.
+    size_t opsPerIteration = 1;
+    // Runs exactly this many iterations instead of calibrating, for cases
+    // whose fixture can only support a bounded number (e.g. undo).
+    size_t fixedIterations = 0;
+    // Needs gigabytes of disk or memory. Skipped unless the run asks for
+    // large cases with --large or BENCH_LARGE=1.
+    bool large = false;
+};
+
+inline std::vector<Case> &registry() {
+    static std::vector<Case> cases;
+    return cases;
+}
+
+struct Register {
+    Register(std::initializer_list<Case> cases) {
+        for (const Case &c : cases) {
+            registry().push_back(c);
+        }
+    }
+};
+
+// Keeps the compiler from discarding a value computed inside a loop.
+template <typename T>
+inline void keep(const T &value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Adds to the bytes a case has produced (cards rendered, data written). The
+// runner reports them as MB/s for cases that call it.
+void countBytes(size_t bytes);
+
+// File descriptor that discards everything written to it. Pattern code
+// writes to stdout, which the runner points here while timing.
+int nullFd();
+
+}
+
+#endif
@@ -0,0 +1,84 @@
+#include "bench.h"
+
+#include "structural/adapter/cloud_storage.cpp"
+
+namespace {
+
+template <typename Service>
+bench::Loop upload() {
+    auto service = std::make_shared<Service>();
+    return [service](size_t iterations) {
+        const string content = "Beam me up, Scotty!";
+        CloudStorage &storage = *service;
+        for (size_t i = 0; i < iterations; i++) {
+            bench::keep(storage.uploadContents(content));
+        }
+    };
+}
+
+template <typename Service>
+bench::Loop freeSpace() {
+    auto service = std::make_shared<Service>();
+    return [service](size_t iterations) {
+        CloudStorage &storage = *service;
+        for (size_t i = 0; i < iterations; i++) {
+            bench::keep(storage.getFreeSpace());
+        }
+    };
+}
+
+// Runs `op` on `threads` threads sharing one adapter, `iterations` times on
+// each. Logging is quiet so the numbers are the adapter's own cost.
+template <typename Op>
+bench::Loop threaded(size_t threads, Op op) {
+    auto adapter = std::make_shared<VirtualDriveAdapter>();
+    return [adapter, threads, op](size_t iterations) {
+        asynclog::setQuiet(true);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; t++) {
+            workers.emplace_back([&] {
+                for (size_t i = 0; i < iterations; i++) {
+                    op(*adapter);
+                }
+            });
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        asynclog::setQuiet(false);
+    };
+}
+
+void uploadOne(VirtualDriveAdapter &adapter) {
+    static const string content = "Beam me up, Scotty!";
+    bench::keep(adapter.uploadContents(content));
+}
+
+void exactFreeSpace(VirtualDriveAdapter &adapter) {
+    bench::keep(adapter.getFreeSpace());
+}
+
+void approximateFreeSpace(VirtualDriveAdapter &adapter) {
+    bench::keep(adapter.approximateFreeSpace());
+}
+
+bench::Register cases{
+    {"cloud_storage/uploadContents/CloudDrive", upload<CloudDrive>},
+    {"cloud_storage/uploadContents/FastShare", upload<FastShare>},
+    {"cloud_storage/uploadContents/VirtualDriveAdapter", upload<VirtualDriveAdapter>},
+    {"cloud_storage/getFreeSpace/VirtualDriveAdapter", freeSpace<VirtualDriveAdapter>},
+    {"cloud_storage/VirtualDriveAdapter/upload/threads:1", [] { return threaded(1, uploadOne); }, 1},
+    {"cloud_storage/VirtualDriveAdapter/upload/threads:4", [] { return threaded(4, uploadOne); }, 4},
+    {"cloud_storage/VirtualDriveAdapter/upload/threads:16", [] { return threaded(16, uploadOne); }, 16},
+    {"cloud_storage/VirtualDriveAdapter/upload/threads:64", [] { return threaded(64, uploadOne); }, 64},
+    {"cloud_storage/VirtualDriveAdapter/getFreeSpace/threads:1", [] { return threaded(1, exactFreeSpace); }, 1},
+    {"cloud_storage/VirtualDriveAdapter/getFreeSpace/threads:4", [] { return threaded(4, exactFreeSpace); }, 4},
+    {"cloud_storage/VirtualDriveAdapter/getFreeSpace/threads:16", [] { return threaded(16, exactFreeSpace); }, 16},
+    {"cloud_storage/VirtualDriveAdapter/getFreeSpace/threads:64", [] { return threaded(64, exactFreeSpace); }, 64},
+    {"cloud_storage/VirtualDriveAdapter/approximateFreeSpace/threads:1", [] { return threaded(1, approximateFreeSpace); }, 1},
+    {"cloud_storage/VirtualDriveAdapter/approximateFreeSpace/threads:4", [] { return threaded(4, approximateFreeSpace); }, 4},
+    {"cloud_storage/VirtualDriveAdapter/approximateFreeSpace/threads:16", [] { return threaded(16, approximateFreeSpace); }, 16},
+    {"cloud_storage/VirtualDriveAdapter/approximateFreeSpace/threads:64", [] { return threaded(64, approximateFreeSpace); }, 64},
+};
+
+}
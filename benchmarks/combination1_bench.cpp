@@ -0,0 +1,153 @@
+#include "bench.h"
+
+#include "behavioral/combination1/combination1.cpp"
+
+namespace {
+
+// The demo's two groups and handler chain.
+struct Chat {
+    ChatUser jim{"Jim"};
+    ChatUser barb{"Barb"};
+    ChatUser hannah{"Hannah"};
+    ChatGroup gardening{"Gardening group"};
+    ChatGroup dogs{"Dog-lovers group"};
+    std::unique_ptr<Handler> chain{new BaseHandler};
+
+    Chat() {
+        gardening.subscribe(&jim);
+        gardening.subscribe(&barb);
+        dogs.subscribe(&barb);
+        dogs.subscribe(&hannah);
+        chain->setNext(new NotEmptyValidator)->setNext(new LengthValidator(2))->setNext(new PostMessageHandler);
+    }
+};
+
+// Groups of four subscribers, spread over a sharded runtime.
+struct Shards {
+    std::vector<std::unique_ptr<ChatUser>> users;
+    std::vector<std::unique_ptr<ChatGroup>> groups;
+    std::unique_ptr<ShardedRuntime> runtime;
+
+    // At least eight groups and one per shard, so wide runtimes have work
+    // for every shard, with twice as many users as groups.
+    Shards(size_t shardCount) {
+        const size_t groupCount = std::max<size_t>(8, shardCount);
+        for (size_t i = 0; i < groupCount * 2; i++) {
+            users.push_back(std::make_unique<ChatUser>("user" + std::to_string(i)));
+        }
+        runtime = std::make_unique<ShardedRuntime>(shardCount);
+        for (size_t i = 0; i < groupCount; i++) {
+            groups.push_back(std::make_unique<ChatGroup>("group" + std::to_string(i)));
+            for (size_t j = 0; j < 4; j++) {
+                groups.back()->subscribe(users[(i * 2 + j) % users.size()].get());
+            }
+            runtime->addGroup(groups.back().get());
+        }
+        runtime->start();
+    }
+    ~Shards() { runtime.reset(); }
+};
+
+// A subscriber that does next to nothing, so publish cases time the message
+// path and its instrumentation rather than logging.
+class QuietSubscriber : public Subscriber {
+    std::string name;
+public:
+    size_t received = 0;
+    QuietSubscriber(std::string name) : name(std::move(name)) {};
+    void notify(const std::string &, std::string_view) override { received++; }
+    std::string getName() override { return name; }
+};
+
+// Publishes to 16 quiet subscribers with metrics on or off. A publish is 17
+// events (16 notifies and the publish), so the difference between the two
+// cases' ns/op is the instrumentation's cost per event.
+bench::Loop instrumentedPublish(bool metrics) {
+    struct Fixture {
+        std::vector<std::unique_ptr<QuietSubscriber>> subscribers;
+        ChatGroup group{"Instrumented group"};
+    };
+    auto fixture = std::make_shared<Fixture>();
+    for (int i = 0; i < 16; i++) {
+        fixture->subscribers.push_back(std::make_unique<QuietSubscriber>("quiet" + std::to_string(i)));
+        fixture->group.subscribe(fixture->subscribers.back().get());
+    }
+    return [fixture, metrics](size_t iterations) {
+        Metrics::setEnabled(metrics);
+        for (size_t i = 0; i < iterations; i++) {
+            fixture->group.publish("Hello everyone!");
+        }
+        Metrics::setEnabled(true);
+        bench::keep(fixture->subscribers.back()->received);
+    };
+}
+
+bench::Loop sharded(size_t shardCount) {
+    auto shards = std::make_shared<Shards>(shardCount);
+    return [shards](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            shards->runtime->submit(new SendMessageCommand(shards->groups[i % shards->groups.size()].get(), "Hello everyone!"));
+        }
+        shards->runtime->drain();
+    };
+}
+
+bench::Register cases{
+    {"combination1/handle", [] {
+        auto chat = std::make_shared<Chat>();
+        auto command = std::make_shared<SendMessageCommand>(&chat->gardening, "Hello everyone in group 1!");
+        return bench::Loop([chat, command](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(chat->chain->handle(command.get()));
+            }
+        });
+    }},
+    {"combination1/publish", [] {
+        auto chat = std::make_shared<Chat>();
+        return bench::Loop([chat](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                chat->gardening.publish("Hello everyone in group 1!");
+            }
+        });
+    }},
+    {"combination1/metrics/stage_timer", [] {
+        return bench::Loop([](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                StageTimer timer(Metrics::Validate);
+            }
+        });
+    }},
+    {"combination1/metrics/clock_read", [] {
+        return bench::Loop([](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(Metrics::now());
+            }
+        });
+    }},
+    {"combination1/metrics/lap", [] {
+        return bench::Loop([](size_t iterations) {
+            LapTimer timer;
+            for (size_t i = 0; i < iterations; i++) {
+                timer.lap(Metrics::Validate);
+            }
+        });
+    }},
+    {"combination1/metrics/publish/subscribers:16/metrics:on", [] { return instrumentedPublish(true); }, 17},
+    {"combination1/metrics/publish/subscribers:16/metrics:off", [] { return instrumentedPublish(false); }, 17},
+    {"combination1/metrics/count_fanout", [] {
+        return bench::Loop([](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                Metrics::countFanout(0, 2);
+            }
+        });
+    }},
+    {"combination1/sharded/shards:1", [] { return sharded(1); }},
+    {"combination1/sharded/shards:2", [] { return sharded(2); }},
+    {"combination1/sharded/shards:4", [] { return sharded(4); }},
+    {"combination1/sharded/shards:8", [] { return sharded(8); }},
+    {"combination1/sharded/shards:16", [] { return sharded(16); }},
+    {"combination1/sharded/shards:32", [] { return sharded(32); }},
+    {"combination1/sharded/shards:64", [] { return sharded(64); }},
+};
+
+}
@@ -0,0 +1,117 @@
+#include "bench.h"
+
+#include <fcntl.h>
+
+#include "behavioral/combination2/combination2.cpp"
+
+namespace {
+
+const char *milestoneSource =
+    "Dear {{name}},\n"
+    "{{#if age >= 50}}Happy {{age}}th! Here's to the next {{age}} years.{{else}}Happy birthday, have a great one!{{/if}}\n"
+    "Love,\n{{from}}\n";
+
+// `count` people of assorted ages sharing one template.
+struct Cards {
+    std::vector<std::unique_ptr<Person>> people;
+    std::shared_ptr<GreetingCardTemplate> cardTemplate;
+    GreetingCardGenerator generator;
+
+    Cards(size_t count, std::shared_ptr<GreetingCardTemplate> chosen) : cardTemplate(std::move(chosen)) {
+        for (size_t i = 0; i < count; i++) {
+            people.push_back(std::make_unique<Person>("Person " + std::to_string(i), int(18 + i % 80)));
+            generator.addPerson(people.back().get());
+        }
+        generator.setTemplate(cardTemplate.get());
+    }
+};
+
+std::shared_ptr<GreetingCardTemplate> birthday() {
+    return std::make_shared<BirthdayCardTemplate>("Bob");
+}
+
+std::shared_ptr<GreetingCardTemplate> milestone() {
+    CardTemplateCache templates;
+    return std::make_shared<TextCardTemplate>(*templates.compile("milestone", milestoneSource), "Grandma");
+}
+
+// The three paths count the card text they produce, so their MB/s compare.
+bench::Loop createCards(std::shared_ptr<GreetingCardTemplate> (*chosen)(), size_t count) {
+    auto cards = std::make_shared<Cards>(count, chosen());
+    return [cards](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            std::vector<std::string> created = cards->generator.createGreetingCards();
+            size_t bytes = 0;
+            for (const auto &card : created) {
+                bytes += card.size();
+            }
+            bench::countBytes(bytes);
+        }
+    };
+}
+
+bench::Loop createBatch(std::shared_ptr<GreetingCardTemplate> (*chosen)(), size_t count) {
+    auto cards = std::make_shared<Cards>(count, chosen());
+    return [cards](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            CardBatch batch = cards->generator.createGreetingCardBatch();
+            bench::countBytes(batch.bytes());
+        }
+    };
+}
+
+bench::Loop stream(std::shared_ptr<GreetingCardTemplate> (*chosen)(), size_t count) {
+    auto cards = std::make_shared<Cards>(count, chosen());
+    return [cards](size_t iterations) {
+        CardSink sink(bench::nullFd());
+        for (size_t i = 0; i < iterations; i++) {
+            cards->generator.streamGreetingCards(sink);
+        }
+        sink.close();
+        bench::countBytes(sink.bytes());
+    };
+}
+
+// Streams into a real file, removed again afterwards, so the writes reach
+// the page cache rather than /dev/null.
+bench::Loop streamToFile(std::shared_ptr<GreetingCardTemplate> (*chosen)(), size_t count) {
+    auto cards = std::make_shared<Cards>(count, chosen());
+    return [cards](size_t iterations) {
+        const std::string path = "cards_bench." + std::to_string(getpid()) + ".txt";
+        const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        unlink(path.c_str());
+        {
+            CardSink sink(fd);
+            for (size_t i = 0; i < iterations; i++) {
+                cards->generator.streamGreetingCards(sink);
+            }
+            sink.close();
+            bench::countBytes(sink.bytes());
+        }
+        close(fd);
+    };
+}
+
+bench::Register cases{
+    {"cards/createGreetingCards/people:1000", [] { return createCards(birthday, 1000); }, 1000},
+    {"cards/createGreetingCardBatch/people:1000", [] { return createBatch(birthday, 1000); }, 1000},
+    {"cards/createGreetingCardBatch/people:100000", [] { return createBatch(birthday, 100000); }, 100000},
+    {"cards/streamGreetingCards/people:1000", [] { return stream(birthday, 1000); }, 1000},
+    // A campaign of a million cards, about 100 MB of text: the vector path
+    // holds all of it at once, streaming only the sink's two 1 MiB buffers.
+    {"cards/createGreetingCards/people:1000000", [] { return createCards(birthday, 1000000); }, 1000000, 1},
+    {"cards/streamGreetingCards/people:1000000", [] { return stream(birthday, 1000000); }, 1000000, 1},
+    {"cards/streamGreetingCards/people:1000000/file", [] { return streamToFile(birthday, 1000000); }, 1000000, 1},
+    {"cards/text_template/createGreetingCards/people:1000", [] { return createCards(milestone, 1000); }, 1000},
+    {"cards/text_template/createGreetingCardBatch/people:1000", [] { return createBatch(milestone, 1000); }, 1000},
+    {"cards/text_template/compile", [] {
+        return bench::Loop([](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                CardTemplateCache templates;
+                bench::keep(templates.compile("milestone", milestoneSource));
+            }
+        });
+    }},
+};
+
+}
@@ -0,0 +1,219 @@
+#include "bench.h"
+
+#include "behavioral/combination3/combination3.cpp"
+
+namespace {
+
+const std::string shapeNames[] = {"rhombus", "triangle", "square", "circle", "hexagon", "pentagon", "star", "ellipse"};
+
+// One edit of a steady editing session: mostly additions, with the canvas
+// cleared every hundred edits so states stay a realistic size.
+void edit(Canvas &canvas, size_t step) {
+    if (step % 100 == 99) {
+        canvas.clearAll();
+    } else {
+        canvas.addShape(shapeNames[step % 8]);
+    }
+}
+
+std::shared_ptr<History> canvasHistory() { return std::make_shared<CanvasHistory>(); }
+std::shared_ptr<History> deltaHistory() { return std::make_shared<DeltaHistory>(); }
+std::shared_ptr<History> spilledHistory() {
+    return std::make_shared<DeltaHistory>(64, 4, "canvas_bench." + std::to_string(getpid()) + ".spill");
+}
+
+struct Editor {
+    std::shared_ptr<History> history;
+    Canvas canvas;
+    size_t steps = 0;
+
+    Editor(std::shared_ptr<History> chosen) : history(std::move(chosen)), canvas(history.get()) {};
+};
+
+// Retained bytes per operation is the memory each recorded state costs.
+bench::Loop addShape(std::shared_ptr<History> (*makeHistory)()) {
+    auto editor = std::make_shared<Editor>(makeHistory());
+    return [editor](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            edit(editor->canvas, editor->steps++);
+        }
+    };
+}
+
+// Sessions of a million edits: addShape() run exactly that many times, then
+// undo() run back through all of them.
+constexpr size_t sessionEdits = 1000000;
+constexpr size_t undoSteps = sessionEdits;
+
+// An editor stepping back `depth` edits and making them again, over and
+// over: with a spill file every pass brings segments back and evicts them.
+bench::Loop undoRedo(size_t depth) {
+    auto editor = std::make_shared<Editor>(spilledHistory());
+    for (; editor->steps < 100000; editor->steps++) {
+        edit(editor->canvas, editor->steps);
+    }
+    return [editor, depth](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            for (size_t k = 0; k < depth; k++) {
+                editor->canvas.undo();
+            }
+            for (size_t k = depth; k > 0; k--) {
+                edit(editor->canvas, editor->steps - k);
+            }
+        }
+    };
+}
+
+bench::Loop undo(std::shared_ptr<History> (*makeHistory)()) {
+    auto editor = std::make_shared<Editor>(makeHistory());
+    for (size_t i = 0; i <= undoSteps; i++) {
+        edit(editor->canvas, i);
+    }
+    return [editor](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            editor->canvas.undo();
+        }
+    };
+}
+
+struct Recorded {
+    std::shared_ptr<DeltaHistory> history = std::make_shared<DeltaHistory>();
+    Canvas canvas{history.get()};
+
+    // Without `clears` the canvas only grows, so late states are large.
+    Recorded(size_t steps, bool clears = true) {
+        for (size_t i = 0; i < steps; i++) {
+            if (clears) {
+                edit(canvas, i);
+            } else {
+                canvas.addShape(shapeNames[i % 8]);
+            }
+        }
+    }
+};
+
+// Renderer threads taking snapshots while an editor keeps adding and undoing.
+struct SharedCanvas {
+    DeltaHistory history;
+    ConcurrentCanvas canvas{&history};
+    std::atomic<bool> editing{true};
+    std::thread editor;
+
+    SharedCanvas() {
+        for (size_t i = 0; i < 50; i++) {
+            canvas.addShape(shapeNames[i % 8]);
+        }
+        editor = std::thread([this] {
+            for (size_t i = 0; editing.load(std::memory_order_relaxed); i++) {
+                canvas.addShape(shapeNames[i % 8]);
+                canvas.undo();
+                std::this_thread::yield();
+            }
+        });
+    }
+    ~SharedCanvas() {
+        editing = false;
+        editor.join();
+    }
+};
+
+bench::Loop snapshots(size_t readerCount) {
+    auto shared = std::make_shared<SharedCanvas>();
+    return [shared, readerCount](size_t iterations) {
+        std::vector<std::thread> readers;
+        for (size_t r = 0; r < readerCount; r++) {
+            readers.emplace_back([&shared, iterations] {
+                const size_t reader = shared->canvas.addReader();
+                size_t total = 0;
+                for (size_t i = 0; i < iterations; i++) {
+                    total += shared->canvas.snapshot(reader).shapes().size();
+                }
+                bench::keep(total);
+                shared->canvas.removeReader(reader);
+            });
+        }
+        for (auto &reader : readers) {
+            reader.join();
+        }
+    };
+}
+
+bench::Loop seek(size_t steps, bool clears) {
+    auto recorded = std::make_shared<Recorded>(steps, clears);
+    return [recorded, steps](size_t iterations) {
+        DeltaCursor cursor(*recorded->history);
+        for (size_t i = 0; i < iterations; i++) {
+            cursor.seek(i * 7919 % steps);
+            bench::keep(cursor.size());
+        }
+    };
+}
+
+bench::Register cases{
+    {"canvas/addShape/CanvasHistory", [] { return addShape(canvasHistory); }},
+    {"canvas/addShape/DeltaHistory", [] { return addShape(deltaHistory); }},
+    {"canvas/addShape/DeltaHistory+spill", [] { return addShape(spilledHistory); }},
+    // Memory over a session's lifetime: compare rss+ across the lengths.
+    {"canvas/session/edits:100000/DeltaHistory", [] { return addShape(deltaHistory); }, 1, 100000},
+    {"canvas/session/edits:100000/DeltaHistory+spill", [] { return addShape(spilledHistory); }, 1, 100000},
+    {"canvas/session/edits:1000000/CanvasHistory", [] { return addShape(canvasHistory); }, 1, sessionEdits},
+    {"canvas/session/edits:1000000/DeltaHistory", [] { return addShape(deltaHistory); }, 1, sessionEdits},
+    {"canvas/session/edits:1000000/DeltaHistory+spill", [] { return addShape(spilledHistory); }, 1, sessionEdits},
+    {"canvas/session/edits:10000000/DeltaHistory", [] { return addShape(deltaHistory); }, 1, 10 * sessionEdits},
+    {"canvas/session/edits:10000000/DeltaHistory+spill", [] { return addShape(spilledHistory); }, 1, 10 * sessionEdits},
+    {"canvas/undo/CanvasHistory/edits:1000000", [] { return undo(canvasHistory); }, 1, undoSteps},
+    {"canvas/undo/DeltaHistory/edits:1000000", [] { return undo(deltaHistory); }, 1, undoSteps},
+    {"canvas/undo/DeltaHistory+spill/edits:1000000", [] { return undo(spilledHistory); }, 1, undoSteps},
+    {"canvas/undo_redo/DeltaHistory+spill/depth:320", [] { return undoRedo(320); }, 640, 1000},
+    {"canvas/replay/DeltaCursor/steps:10000", [] {
+        auto recorded = std::make_shared<Recorded>(10000);
+        return bench::Loop([recorded](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                DeltaCursor cursor(*recorded->history);
+                while (cursor.next()) {
+                    bench::keep(cursor.size());
+                }
+            }
+        });
+    }, 10000},
+    {"canvas/replay/DeltaCursor/steps:1000000", [] {
+        auto recorded = std::make_shared<Recorded>(1000000);
+        return bench::Loop([recorded](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                DeltaCursor cursor(*recorded->history);
+                while (cursor.next()) {
+                    bench::keep(cursor.size());
+                }
+            }
+        });
+    }, 1000000},
+    {"canvas/replay/SeekableReplayCanvas/steps:1000", [] {
+        auto recorded = std::make_shared<Recorded>(1000);
+        return bench::Loop([recorded](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                SeekableReplayCanvas replay(*recorded->history);
+                replay.replay();
+            }
+        });
+    }, 1000},
+    {"canvas/seek/steps:10000", [] { return seek(10000, true); }},
+    // States of up to 10000 shapes: a seek costs the deltas it applies, not
+    // the size of the state it lands on.
+    {"canvas/seek/steps:10000/shapes:10000", [] { return seek(10000, false); }},
+    {"canvas/getShapes/shapes:99", [] {
+        auto recorded = std::make_shared<Recorded>(99);
+        return bench::Loop([recorded](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(recorded->canvas.getShapes());
+            }
+        });
+    }},
+    {"canvas/concurrent/snapshot/readers:1", [] { return snapshots(1); }, 1},
+    {"canvas/concurrent/snapshot/readers:2", [] { return snapshots(2); }, 2},
+    {"canvas/concurrent/snapshot/readers:4", [] { return snapshots(4); }, 4},
+    {"canvas/concurrent/snapshot/readers:8", [] { return snapshots(8); }, 8},
+    {"canvas/concurrent/snapshot/readers:16", [] { return snapshots(16); }, 16},
+    {"canvas/concurrent/snapshot/readers:32", [] { return snapshots(32); }, 32},
+};
+
+}
@@ -0,0 +1,355 @@
+#include "bench.h"
+
+#include <cstdlib>
+
+#include "behavioral/command_design_pattern.cpp"
+
+namespace {
+
+// The demo's two groups and handler chain.
+struct Chat {
+    ChatUser jim{"Jim"};
+    ChatUser barb{"Barb"};
+    ChatUser hannah{"Hannah"};
+    ChatGroup gardening{"Gardening Group"};
+    ChatGroup dogs{"Dog-lovers Group"};
+    std::unique_ptr<Handler> chain{new BaseHandler};
+
+    Chat(CommandLog *log = nullptr) {
+        gardening.subscribe(&jim);
+        gardening.subscribe(&barb);
+        dogs.subscribe(&barb);
+        dogs.subscribe(&hannah);
+        chain->setNext(new NotEmptyValidator)->setNext(new LengthValidator(2))->setNext(new PostMessageHandler(log));
+    }
+};
+
+// Counts what it is shown without copying it, so any allocation or copy in a
+// publish is the message path's own.
+class CountingSubscriber : public Subscriber {
+    std::string name;
+public:
+    size_t bytesSeen = 0;
+    CountingSubscriber(std::string name) : name(std::move(name)) {};
+    void notify(const std::string &, std::string_view message) override {
+        bytesSeen += message.size();
+    }
+    std::string getName() override { return name; }
+};
+
+// Builds a payload of `size` bytes, wraps it in a command and sends it through
+// the demo chain to `subscribers` subscribers. With shared payloads,
+// allocations and bytes per publish are those of building the one payload,
+// whatever the subscriber count.
+bench::Loop payloadPublish(size_t size, size_t subscribers) {
+    struct Fixture {
+        std::vector<std::unique_ptr<CountingSubscriber>> subscribers;
+        ChatGroup group{"Payload group"};
+        std::unique_ptr<Handler> chain{new BaseHandler};
+        std::string text;
+    };
+    auto fixture = std::make_shared<Fixture>();
+    for (size_t i = 0; i < subscribers; i++) {
+        fixture->subscribers.push_back(std::make_unique<CountingSubscriber>("subscriber" + std::to_string(i)));
+        fixture->group.subscribe(fixture->subscribers.back().get());
+    }
+    fixture->chain->setNext(new NotEmptyValidator)->setNext(new LengthValidator(2))->setNext(new PostMessageHandler);
+    fixture->text.assign(size, 'x');
+    return [fixture](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            SendMessageCommand command(&fixture->group, MessagePayload(fixture->text));
+            bench::keep(fixture->chain->handle(&command));
+        }
+        bench::keep(fixture->subscribers.back()->bytesSeen);
+    };
+}
+
+// A mix of valid, empty and too-short messages across both groups.
+struct Batch : Chat {
+    std::vector<std::unique_ptr<MessageCommand>> owned;
+    std::vector<MessageCommand*> commands;
+    std::vector<ValidationOutcome> results;
+    ValidationPipeline pipeline = chain->compile();
+
+    Batch(size_t size) {
+        const MessagePayload messages[] = {"Hello everyone!", "", "H", "Tomatoes are in!", "Walk at noon?"};
+        for (size_t i = 0; i < size; i++) {
+            owned.emplace_back(new SendMessageCommand(i % 2 ? &gardening : &dogs, messages[i % 5]));
+            commands.push_back(owned.back().get());
+        }
+    }
+};
+
+bench::Loop handleBatch(size_t size) {
+    auto batch = std::make_shared<Batch>(size);
+    return [batch](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            for (auto command : batch->commands) {
+                bench::keep(batch->chain->handle(command));
+            }
+        }
+    };
+}
+
+bench::Loop runBatch(size_t size) {
+    auto batch = std::make_shared<Batch>(size);
+    return [batch](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            batch->pipeline.run(batch->commands, batch->results);
+        }
+    };
+}
+
+bench::Loop validateBatch(size_t size) {
+    auto batch = std::make_shared<Batch>(size);
+    return [batch](size_t iterations) {
+        for (size_t i = 0; i < iterations; i++) {
+            batch->pipeline.validate(batch->commands, batch->results);
+            bench::keep(batch->results);
+        }
+    };
+}
+
+// Commands allocated on this thread and deleted on another, in batches of
+// `batchSize`, the way the executor's delivery thread frees them. Freed blocks
+// have to find their way back to this thread's pool; if they did not, every
+// round would carve new chunks and RSS would grow with the run.
+bench::Loop crossThreadFree(size_t batchSize) {
+    auto chat = std::make_shared<Chat>();
+    return [chat, batchSize](size_t iterations) {
+        std::mutex mutex;
+        std::condition_variable handedOver;
+        std::vector<MessageCommand*> batch;
+        bool done = false;
+        std::thread consumer([&] {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                handedOver.wait(lock, [&] { return !batch.empty() || done; });
+                if (batch.empty()) {
+                    return;
+                }
+                for (auto command : batch) {
+                    delete command;
+                }
+                batch.clear();
+                handedOver.notify_all();
+            }
+        });
+        const MessagePayload payload("Hello everyone!");
+        std::vector<MessageCommand*> next;
+        for (size_t i = 0; i < iterations; i++) {
+            for (size_t j = 0; j < batchSize; j++) {
+                next.push_back(new SendMessageCommand(&chat->gardening, payload));
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            handedOver.wait(lock, [&] { return batch.empty(); });
+            batch.swap(next);
+            handedOver.notify_all();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        handedOver.notify_all();
+        consumer.join();
+    };
+}
+
+// Commands submitted back to back, so batches fill up; ns/op is the executor's
+// throughput. command/direct_handle does the same work with handle() on the
+// calling thread.
+bench::Loop executorThroughput(std::chrono::microseconds maxLatency) {
+    auto chat = std::make_shared<Chat>();
+    return [chat, maxLatency](size_t iterations) {
+        CommandExecutor executor(chat->chain.get(), {256, maxLatency});
+        for (size_t i = 0; i < iterations; i++) {
+            executor.submit(new SendMessageCommand(i % 2 ? &chat->gardening : &chat->dogs, "Hello everyone!"));
+        }
+        executor.shutdown();
+    };
+}
+
+// One command at a time, each waited for until it is delivered; ns/op is the
+// latency the executor adds to a lone command.
+bench::Loop executorLatency(std::chrono::microseconds maxLatency) {
+    auto chat = std::make_shared<Chat>();
+    return [chat, maxLatency](size_t iterations) {
+        CommandExecutor executor(chat->chain.get(), {256, maxLatency});
+        for (size_t i = 0; i < iterations; i++) {
+            executor.submit(new SendMessageCommand(&chat->gardening, "Hello everyone!"));
+            while (executor.deliveredCount() <= i) {
+                std::this_thread::yield();
+            }
+        }
+        executor.shutdown();
+    };
+}
+
+// A CommandLog in a file of its own under $TMPDIR (or /tmp), removed again
+// afterwards.
+std::string scratchDirectory() {
+    const char *tmp = std::getenv("TMPDIR");
+    return tmp && *tmp ? tmp : "/tmp";
+}
+
+struct ScratchLog {
+    std::string path = scratchDirectory() + "/command_bench." + std::to_string(getpid()) + ".log";
+    std::unique_ptr<CommandLog> log;
+
+    ScratchLog() {
+        unlink(path.c_str());
+        log = std::make_unique<CommandLog>(path);
+    }
+    ~ScratchLog() {
+        log.reset();
+        unlink(path.c_str());
+    }
+    // Closes the log, evicts the file from the page cache and opens it again,
+    // so a replay reads from disk as it would after a restart.
+    void reopenCold() {
+        log.reset();
+        const int fd = open(path.c_str(), O_RDONLY);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+        log = std::make_unique<CommandLog>(path);
+    }
+};
+
+void appendRecords(CommandLog &log, size_t count, size_t commitEvery) {
+    for (size_t i = 0; i < count; i++) {
+        log.append("Gardening Group", "Hello everyone in group 1!");
+        if ((i + 1) % commitEvery == 0) {
+            log.commit();
+        }
+    }
+    log.commit();
+}
+
+size_t replayBytes(CommandLog &log) {
+    size_t bytes = 0;
+    log.replay([&bytes](std::string_view group, std::string_view message) {
+        bytes += group.size() + message.size();
+    });
+    return bytes;
+}
+
+// The scale the log is meant for: 100M records of 49 bytes, about 4.9 GB on
+// disk, group-committed every 65536 records. Marked large, so these run only
+// with --large.
+constexpr size_t largeLogRecords = 100000000;
+constexpr size_t largeLogCommitEvery = 65536;
+
+bench::Register cases{
+    {"command/handle", [] {
+        auto chat = std::make_shared<Chat>();
+        auto command = std::make_shared<SendMessageCommand>(&chat->gardening, "Hello everyone in group 1!");
+        return bench::Loop([chat, command](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(chat->chain->handle(command.get()));
+            }
+        });
+    }},
+    {"command/handle/metrics:off", [] {
+        auto chat = std::make_shared<Chat>();
+        auto command = std::make_shared<SendMessageCommand>(&chat->gardening, "Hello everyone in group 1!");
+        return bench::Loop([chat, command](size_t iterations) {
+            Metrics::setEnabled(false);
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(chat->chain->handle(command.get()));
+            }
+            Metrics::setEnabled(true);
+        });
+    }},
+    {"command/publish", [] {
+        auto chat = std::make_shared<Chat>();
+        return bench::Loop([chat](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                chat->gardening.publish("Hello everyone in group 1!");
+            }
+        });
+    }},
+    {"command/publish_payload/size:16B/subscribers:1", [] { return payloadPublish(16, 1); }},
+    {"command/publish_payload/size:16B/subscribers:16", [] { return payloadPublish(16, 16); }},
+    {"command/publish_payload/size:1KiB/subscribers:1", [] { return payloadPublish(1024, 1); }},
+    {"command/publish_payload/size:1KiB/subscribers:16", [] { return payloadPublish(1024, 16); }},
+    {"command/publish_payload/size:64KiB/subscribers:1", [] { return payloadPublish(65536, 1); }},
+    {"command/publish_payload/size:64KiB/subscribers:16", [] { return payloadPublish(65536, 16); }},
+    {"command/publish_payload/size:1MiB/subscribers:1", [] { return payloadPublish(1048576, 1); }},
+    {"command/publish_payload/size:1MiB/subscribers:16", [] { return payloadPublish(1048576, 16); }},
+    {"command/new_delete", [] {
+        auto chat = std::make_shared<Chat>();
+        return bench::Loop([chat](size_t iterations) {
+            const MessagePayload payload("Hello everyone in group 1!");
+            for (size_t i = 0; i < iterations; i++) {
+                MessageCommand *command = new SendMessageCommand(&chat->gardening, payload);
+                bench::keep(command);
+                delete command;
+            }
+        });
+    }},
+    {"command/pool/cross_thread_free/batch:1024", [] { return crossThreadFree(1024); }, 1024},
+    {"command/handle/batch:1024", [] { return handleBatch(1024); }, 1024},
+    {"command/handle/batch:1048576", [] { return handleBatch(1 << 20); }, 1 << 20},
+    {"command/pipeline_run/batch:1024", [] { return runBatch(1024); }, 1024},
+    {"command/pipeline_run/batch:1048576", [] { return runBatch(1 << 20); }, 1 << 20},
+    {"command/pipeline_validate/batch:1024", [] { return validateBatch(1024); }, 1024},
+    {"command/pipeline_validate/batch:1048576", [] { return validateBatch(1 << 20); }, 1 << 20},
+    {"command/direct_handle", [] {
+        auto chat = std::make_shared<Chat>();
+        return bench::Loop([chat](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                std::unique_ptr<MessageCommand> command(new SendMessageCommand(i % 2 ? &chat->gardening : &chat->dogs, "Hello everyone!"));
+                bench::keep(chat->chain->handle(command.get()));
+            }
+        });
+    }},
+    {"command/executor/throughput/max_latency:0us", [] { return executorThroughput(std::chrono::microseconds(0)); }},
+    {"command/executor/throughput/max_latency:200us", [] { return executorThroughput(std::chrono::microseconds(200)); }},
+    {"command/executor/latency/max_latency:0us", [] { return executorLatency(std::chrono::microseconds(0)); }},
+    {"command/executor/latency/max_latency:200us", [] { return executorLatency(std::chrono::microseconds(200)); }},
+    {"command/log/commit_each", [] {
+        auto scratch = std::make_shared<ScratchLog>();
+        return bench::Loop([scratch](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                scratch->log->append("Gardening Group", "Hello everyone in group 1!");
+                scratch->log->commit();
+            }
+        });
+    }},
+    {"command/log/group_commit:64", [] {
+        auto scratch = std::make_shared<ScratchLog>();
+        return bench::Loop([scratch](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                for (size_t j = 0; j < 64; j++) {
+                    scratch->log->append("Gardening Group", "Hello everyone in group 1!");
+                }
+                scratch->log->commit();
+            }
+        });
+    }, 64},
+    {"command/log/replay/records:10000", [] {
+        auto scratch = std::make_shared<ScratchLog>();
+        appendRecords(*scratch->log, 10000, 10000);
+        return bench::Loop([scratch](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(replayBytes(*scratch->log));
+            }
+        });
+    }, 10000},
+    {"command/log/append/records:100000000", [] {
+        auto scratch = std::make_shared<ScratchLog>();
+        return bench::Loop([scratch](size_t) {
+            appendRecords(*scratch->log, largeLogRecords, largeLogCommitEvery);
+        });
+    }, largeLogRecords, 1, true},
+    {"command/log/replay_cold/records:100000000", [] {
+        auto scratch = std::make_shared<ScratchLog>();
+        appendRecords(*scratch->log, largeLogRecords, largeLogCommitEvery);
+        scratch->reopenCold();
+        return bench::Loop([scratch](size_t) {
+            bench::keep(replayBytes(*scratch->log));
+        });
+    }, largeLogRecords, 1, true},
+};
+
+}
@@ -0,0 +1,85 @@
+#include "bench.h"
+#include "common/async_log.h"
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const std::string location = "San Francisco, CA, US";
+
+// The line the weather providers used to write on every call.
+void coutLine() {
+    std::cout << "Calling worldWeather with location: " << location << std::endl;
+}
+
+void asyncLine() {
+    LOG_INFO("Calling worldWeather with location: ", location);
+}
+
+void asyncLiteralLine() {
+    LOG_INFO(asynclog::Literal("Calling worldWeather with location: "), location);
+}
+
+// Every thread writes `iterations` lines. The async loops end with a flush,
+// so the writer's formatting and output are part of the measured time.
+template <void (*line)()>
+bench::Loop threaded(size_t threads, bool flush) {
+    return [threads, flush](size_t iterations) {
+        std::vector<std::thread> writers;
+        for (size_t t = 0; t < threads; t++) {
+            writers.emplace_back([iterations] {
+                for (size_t i = 0; i < iterations; i++) {
+                    line();
+                }
+            });
+        }
+        for (auto &writer : writers) {
+            writer.join();
+        }
+        if (flush) {
+            asynclog::flush();
+        }
+    };
+}
+
+bench::Register cases{
+    {"logging/cout_endl", [] {
+        return bench::Loop([](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                coutLine();
+            }
+        });
+    }},
+    {"logging/async", [] {
+        return bench::Loop([](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                asyncLine();
+            }
+            asynclog::flush();
+        });
+    }},
+    {"logging/async/literal", [] {
+        return bench::Loop([](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                asyncLiteralLine();
+            }
+            asynclog::flush();
+        });
+    }},
+    {"logging/async_quiet", [] {
+        return bench::Loop([](size_t iterations) {
+            asynclog::setQuiet(true);
+            for (size_t i = 0; i < iterations; i++) {
+                asyncLine();
+            }
+            asynclog::setQuiet(false);
+        });
+    }},
+    {"logging/cout_endl/threads:4", [] { return threaded<coutLine>(4, false); }, 4},
+    {"logging/async/threads:4", [] { return threaded<asyncLine>(4, true); }, 4},
+};
+
+}
@@ -0,0 +1,44 @@
+#include "bench.h"
+
+#include "structural/decorator/pizza.cpp"
+
+namespace {
+
+// A pepperoni pizza with mushrooms and extra cheese: two decorator hops.
+struct DecoratedPizza {
+    PepperoniPizza base;
+    MushroomToppings mushrooms{&base};
+    ExtraCheese cheese{&mushrooms};
+};
+
+bench::Register cases{
+    {"pizza/price/plain", [] {
+        auto pizza = std::make_shared<MargheritaPizza>();
+        return bench::Loop([pizza](size_t iterations) {
+            const Pizza &p = *pizza;
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(p.price());
+            }
+        });
+    }},
+    {"pizza/price/two_toppings", [] {
+        auto pizza = std::make_shared<DecoratedPizza>();
+        return bench::Loop([pizza](size_t iterations) {
+            const Pizza &p = pizza->cheese;
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(p.price());
+            }
+        });
+    }},
+    {"pizza/description/two_toppings", [] {
+        auto pizza = std::make_shared<DecoratedPizza>();
+        return bench::Loop([pizza](size_t iterations) {
+            const Pizza &p = pizza->cheese;
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(p.description());
+            }
+        });
+    }},
+};
+
+}
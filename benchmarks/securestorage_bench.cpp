@@ -0,0 +1,22 @@
+#include "bench.h"
+
+#include "structural/proxy/securestorage.cpp"
+
+namespace {
+
+bench::Loop getContents(int code) {
+    auto proxy = std::make_shared<SecureStorageProxy>("Top Secret Information", code);
+    return [proxy](size_t iterations) {
+        Storage &storage = *proxy;
+        for (size_t i = 0; i < iterations; i++) {
+            bench::keep(storage.getContents());
+        }
+    };
+}
+
+bench::Register cases{
+    {"securestorage/getContents/authorized", [] { return getContents(1431); }},
+    {"securestorage/getContents/denied", [] { return getContents(0); }},
+};
+
+}
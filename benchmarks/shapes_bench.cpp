@@ -0,0 +1,36 @@
+#include "bench.h"
+
+#include "structural/composite/shapes.cpp"
+
+namespace {
+
+// Eight circles and eight rectangles under one composite.
+struct Scene {
+    std::vector<Circle> circles;
+    std::vector<Rectangle> rectangles;
+    CompositeShape composite;
+    Scene() {
+        for (int i = 0; i < 8; i++) {
+            circles.emplace_back(i + 1);
+            rectangles.emplace_back(i + 1, i + 2);
+        }
+        for (int i = 0; i < 8; i++) {
+            composite.add_shape(circles[i]);
+            composite.add_shape(rectangles[i]);
+        }
+    }
+};
+
+bench::Register cases{
+    {"shapes/CompositeShape::draw/children:16", [] {
+        auto scene = std::make_shared<Scene>();
+        return bench::Loop([scene](size_t iterations) {
+            const Shape &shape = scene->composite;
+            for (size_t i = 0; i < iterations; i++) {
+                shape.draw();
+            }
+        });
+    }},
+};
+
+}
@@ -0,0 +1,24 @@
+#include "bench.h"
+
+#include "structural/bridge/vehicles_engine.cpp"
+
+namespace {
+
+struct Fleet {
+    EvEngine engine;
+    car vehicle{engine};
+};
+
+bench::Register cases{
+    {"vehicles_engine/drive", [] {
+        auto fleet = std::make_shared<Fleet>();
+        return bench::Loop([fleet](size_t iterations) {
+            const IVehicle &vehicle = fleet->vehicle;
+            for (size_t i = 0; i < iterations; i++) {
+                vehicle.drive();
+            }
+        });
+    }},
+};
+
+}
@@ -0,0 +1,45 @@
+#include "bench.h"
+
+#include "structural/facade/weather.cpp"
+
+namespace {
+
+bench::Register cases{
+    {"weather/currentWeather", [] {
+        auto weather = std::make_shared<Weather>();
+        return bench::Loop([weather](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(weather->currentWeather("San Francisco, CA, US"));
+            }
+        });
+    }},
+    {"weather/PrefetchingWeather/hit", [] {
+        auto weather = std::make_shared<PrefetchingWeather>();
+        const auto now = PrefetchingWeather::Clock::now();
+        const std::string location = "San Francisco, CA, US";
+        weather->currentWeather(location, now);
+        return bench::Loop([weather, now, location](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(weather->currentWeather(location, now));
+            }
+        });
+    }},
+    {"weather/simulateDay/on_demand", [] {
+        return bench::Loop([](size_t iterations) {
+            PrefetchingWeather::Options options;
+            options.prefetch = false;
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(simulateDay(options));
+            }
+        });
+    }, 1, 3},
+    {"weather/simulateDay/prefetch", [] {
+        return bench::Loop([](size_t iterations) {
+            for (size_t i = 0; i < iterations; i++) {
+                bench::keep(simulateDay(PrefetchingWeather::Options()));
+            }
+        });
+    }, 1, 3},
+};
+
+}
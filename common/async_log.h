@@ -0,0 +1,450 @@
+/*
+ * Asynchronous logging for hot paths.
+ *
+ *     LOG_INFO("Uploading ", content.length(), " bytes to CloudDrive");
+ *
+ * A call encodes its arguments into a compact binary record in the calling
+ * thread's own ring buffer and returns; nothing is formatted and no lock is
+ * taken. A background writer thread drains every ring, formats the records
+ * and hands whole batches of lines to a Sink (stdout by default), so a slow
+ * terminal never blocks the caller and threads never contend on a stream.
+ *
+ * Each call is one line. Arguments may be strings, characters, integers,
+ * floating-point numbers and bools, and are copied into the record. Wrapping
+ * a string literal in asynclog::Literal stores only its address instead:
+ *
+ *     LOG_DEBUG(asynclog::Literal("Cache hit for "), key);
+ *
+ * Levels below ASYNC_LOG_LEVEL (0 debug, 1 info, 2 warn, 3 error, 4 none)
+ * are compiled out. setLevel() and setQuiet() filter at runtime.
+ *
+ * Output is asynchronous: call asynclog::flush() before writing to std::cout
+ * directly when the order of the two matters.
+ */
+
+#ifndef DESIGN_PATTERNS_ASYNC_LOG_H
+#define DESIGN_PATTERNS_ASYNC_LOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <unistd.h>
+
+#ifndef ASYNC_LOG_LEVEL
+#define ASYNC_LOG_LEVEL 0
+#endif
+
+#define ASYNC_LOG(level, ...) \
+    do { \
+        if constexpr (int(level) >= ASYNC_LOG_LEVEL) { \
+            ::asynclog::log(level, __VA_ARGS__); \
+        } \
+    } while (0)
+#define LOG_DEBUG(...) ASYNC_LOG(::asynclog::Debug, __VA_ARGS__)
+#define LOG_INFO(...) ASYNC_LOG(::asynclog::Info, __VA_ARGS__)
+#define LOG_WARN(...) ASYNC_LOG(::asynclog::Warn, __VA_ARGS__)
+#define LOG_ERROR(...) ASYNC_LOG(::asynclog::Error, __VA_ARGS__)
+
+namespace asynclog {
+
+enum Level { Debug, Info, Warn, Error, Off };
+
+// A string literal, stored in records by address rather than copied.
+// Wrapping a string promises that it outlives the record; plain char arrays,
+// which may be local buffers, are always copied.
+struct Literal {
+    const char *text;
+    uint32_t length;
+    template <size_t N>
+    constexpr Literal(const char (&literal)[N]) : text(literal), length(uint32_t(N - 1)) {};
+};
+
+// Where formatted lines go. Only the writer thread calls a sink: write() once
+// per line, then flush() once per batch of lines.
+class Sink {
+public:
+    virtual ~Sink() {};
+    virtual void write(Level level, std::string_view line) = 0;
+    virtual void flush() = 0;
+};
+
+// Collects a batch of lines and outputs it in one piece.
+class BufferedSink : public Sink {
+    std::string buffer;
+protected:
+    virtual void output(const char *data, size_t size) = 0;
+public:
+    void write(Level, std::string_view line) override {
+        buffer.append(line).push_back('\n');
+    }
+    void flush() override {
+        if (!buffer.empty()) {
+            output(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+};
+
+// Writes through stdio, so lines share stdout's buffer with std::cout.
+class StdoutSink : public BufferedSink {
+protected:
+    void output(const char *data, size_t size) override {
+        std::fwrite(data, 1, size, stdout);
+    }
+};
+
+class FdSink : public BufferedSink {
+    int fd;
+protected:
+    void output(const char *data, size_t size) override {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            data += written;
+            size -= written;
+        }
+    }
+public:
+    FdSink(int fd) : fd(fd) {};
+};
+
+namespace detail {
+
+// Byte ring with one producer (the thread that owns it) and one consumer
+// (the writer). Records are [u32 size][u8 level][arguments...], written with
+// wraparound and published by advancing head.
+struct Ring {
+    static constexpr size_t capacity = size_t(1) << 16;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    // Set when the owning thread exits; the writer drops the ring once empty.
+    std::atomic<bool> abandoned{false};
+    char data[capacity];
+
+    void put(size_t position, const void *bytes, size_t size) {
+        const size_t offset = position % capacity;
+        const size_t first = std::min(size, capacity - offset);
+        std::memcpy(data + offset, bytes, first);
+        std::memcpy(data, static_cast<const char*>(bytes) + first, size - first);
+    }
+    void get(size_t position, void *bytes, size_t size) const {
+        const size_t offset = position % capacity;
+        const size_t first = std::min(size, capacity - offset);
+        std::memcpy(bytes, data + offset, first);
+        std::memcpy(static_cast<char*>(bytes) + first, data, size - first);
+    }
+};
+
+enum Tag : uint8_t { Borrowed, Text, Signed, Unsigned, Floating, Character };
+
+// Longer strings are cut so that any record fits in a ring.
+static constexpr size_t maxText = 4096;
+static constexpr size_t recordHeader = sizeof(uint32_t) + 1;
+
+template <typename T>
+struct unsupported : std::false_type {};
+
+// A char array is read up to its first NUL but never past its end.
+template <typename T>
+std::string_view textOf(const T &value) {
+    if constexpr (std::is_array<T>::value) {
+        return std::string_view(value, strnlen(value, std::extent<T>::value));
+    } else {
+        return std::string_view(value);
+    }
+}
+
+template <typename T>
+size_t encodedSize(const T &value) {
+    if constexpr (std::is_same<T, Literal>::value) {
+        return 1 + sizeof(const char*) + sizeof(uint32_t);
+    } else if constexpr (std::is_same<T, char>::value) {
+        return 2;
+    } else if constexpr (std::is_arithmetic<T>::value) {
+        return 1 + 8;
+    } else if constexpr (std::is_convertible<const T &, std::string_view>::value) {
+        return 1 + sizeof(uint32_t) + std::min(textOf(value).size(), maxText);
+    } else {
+        static_assert(unsupported<T>::value, "unsupported log argument type");
+        return 0;
+    }
+}
+
+template <typename T>
+void encode(Ring &ring, size_t &position, const T &value) {
+    auto put = [&](const void *bytes, size_t size) {
+        ring.put(position, bytes, size);
+        position += size;
+    };
+    uint8_t tag;
+    if constexpr (std::is_same<T, Literal>::value) {
+        put(&(tag = Borrowed), 1);
+        put(&value.text, sizeof(value.text));
+        put(&value.length, sizeof(value.length));
+    } else if constexpr (std::is_same<T, char>::value) {
+        put(&(tag = Character), 1);
+        put(&value, 1);
+    } else if constexpr (std::is_floating_point<T>::value) {
+        const double number = value;
+        put(&(tag = Floating), 1);
+        put(&number, 8);
+    } else if constexpr (std::is_signed<T>::value) {
+        const int64_t number = value;
+        put(&(tag = Signed), 1);
+        put(&number, 8);
+    } else if constexpr (std::is_arithmetic<T>::value) {
+        const uint64_t number = value;
+        put(&(tag = Unsigned), 1);
+        put(&number, 8);
+    } else {
+        const std::string_view text = textOf(value).substr(0, maxText);
+        const uint32_t length = uint32_t(text.size());
+        put(&(tag = Text), 1);
+        put(&length, sizeof(length));
+        put(text.data(), text.size());
+    }
+}
+
+// Turns one record back into text.
+inline void format(const char *record, size_t size, std::string &line) {
+    const char *in = record + recordHeader;
+    const char *end = record + size;
+    char digits[32];
+    while (in < end) {
+        const Tag tag = Tag(*in++);
+        if (tag == Borrowed) {
+            const char *text;
+            uint32_t length;
+            std::memcpy(&text, in, sizeof(text));
+            std::memcpy(&length, in + sizeof(text), sizeof(length));
+            line.append(text, length);
+            in += sizeof(text) + sizeof(length);
+        } else if (tag == Text) {
+            uint32_t length;
+            std::memcpy(&length, in, sizeof(length));
+            line.append(in + sizeof(length), length);
+            in += sizeof(length) + length;
+        } else if (tag == Character) {
+            line.push_back(*in++);
+        } else if (tag == Floating) {
+            double number;
+            std::memcpy(&number, in, 8);
+            line.append(digits, std::snprintf(digits, sizeof(digits), "%g", number));
+            in += 8;
+        } else {
+            uint64_t bits;
+            std::memcpy(&bits, in, 8);
+            char *last = tag == Signed ? std::to_chars(digits, digits + sizeof(digits), int64_t(bits)).ptr
+                                       : std::to_chars(digits, digits + sizeof(digits), bits).ptr;
+            line.append(digits, last);
+            in += 8;
+        }
+    }
+}
+
+class Logger {
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::condition_variable flushed;
+    std::vector<std::shared_ptr<Ring>> rings;
+    uint64_t ringsVersion = 0;
+    uint64_t flushRequests = 0;
+    uint64_t flushesDone = 0;
+    bool stopping = false;
+    std::thread writer;
+    std::atomic<bool> poked{false};
+
+    std::mutex sinkMutex;
+    std::unique_ptr<Sink> sink = std::make_unique<StdoutSink>();
+
+    // Drains every ring it knows about; returns whether anything was written.
+    bool drain(std::vector<std::shared_ptr<Ring>> &active, std::vector<char> &record, std::string &line) {
+        bool wrote = false;
+        std::lock_guard<std::mutex> lock(sinkMutex);
+        for (auto &ring : active) {
+            size_t tail = ring->tail.load(std::memory_order_relaxed);
+            const size_t head = ring->head.load(std::memory_order_acquire);
+            while (tail != head) {
+                uint32_t size;
+                ring->get(tail, &size, sizeof(size));
+                record.resize(size);
+                ring->get(tail, record.data(), size);
+                line.clear();
+                format(record.data(), size, line);
+                sink->write(Level(record[sizeof(uint32_t)]), line);
+                tail += size;
+                wrote = true;
+            }
+            ring->tail.store(tail, std::memory_order_release);
+        }
+        if (wrote) {
+            sink->flush();
+        }
+        return wrote;
+    }
+
+    void writeLoop() {
+        std::vector<std::shared_ptr<Ring>> active;
+        uint64_t activeVersion = 0;
+        std::vector<char> record;
+        std::string line;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wakeup.wait_for(lock, std::chrono::milliseconds(1), [this] {
+                return stopping || flushRequests != flushesDone || poked.load(std::memory_order_relaxed);
+            });
+            poked.store(false, std::memory_order_relaxed);
+            const uint64_t requested = flushRequests;
+            const bool stop = stopping;
+            if (activeVersion != ringsVersion) {
+                active = rings;
+                activeVersion = ringsVersion;
+            }
+            lock.unlock();
+            drain(active, record, line);
+            lock.lock();
+            const size_t before = rings.size();
+            rings.erase(std::remove_if(rings.begin(), rings.end(), [](const std::shared_ptr<Ring> &ring) {
+                return ring->abandoned.load(std::memory_order_acquire) &&
+                    ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire);
+            }), rings.end());
+            if (rings.size() != before) {
+                ringsVersion++;
+            }
+            flushesDone = requested;
+            flushed.notify_all();
+            if (stop) {
+                return;
+            }
+        }
+    }
+
+    Logger() {};
+public:
+    std::atomic<int> minimumLevel{Debug};
+    std::atomic<bool> quiet{false};
+    std::atomic<uint64_t> dropped{0};
+
+    static Logger &instance() {
+        static Logger logger;
+        return logger;
+    }
+    ~Logger() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        if (writer.joinable()) {
+            writer.join();
+        }
+    }
+
+    std::shared_ptr<Ring> addRing() {
+        auto ring = std::make_shared<Ring>();
+        std::lock_guard<std::mutex> lock(mutex);
+        rings.push_back(ring);
+        ringsVersion++;
+        if (!writer.joinable()) {
+            writer = std::thread(&Logger::writeLoop, this);
+        }
+        return ring;
+    }
+
+    void poke() {
+        poked.store(true, std::memory_order_relaxed);
+        wakeup.notify_one();
+    }
+
+    // Returns once every record logged before the call has reached the sink.
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!writer.joinable()) {
+            return;
+        }
+        const uint64_t ticket = ++flushRequests;
+        wakeup.notify_one();
+        flushed.wait(lock, [this, ticket] { return flushesDone >= ticket; });
+    }
+
+    void setSink(std::unique_ptr<Sink> newSink) {
+        flush();
+        std::lock_guard<std::mutex> lock(sinkMutex);
+        sink = std::move(newSink);
+    }
+};
+
+struct ThreadRing {
+    std::shared_ptr<Ring> ring = Logger::instance().addRing();
+    ~ThreadRing() { ring->abandoned.store(true, std::memory_order_release); }
+};
+
+inline Ring &localRing() {
+    thread_local ThreadRing local;
+    return *local.ring;
+}
+
+}
+
+template <typename... Args>
+void log(Level level, const Args &... args) {
+    detail::Logger &logger = detail::Logger::instance();
+    if (level < logger.minimumLevel.load(std::memory_order_relaxed) || logger.quiet.load(std::memory_order_relaxed)) {
+        return;
+    }
+    const size_t size = detail::recordHeader + (size_t(0) + ... + detail::encodedSize(args));
+    if (size > detail::Ring::capacity) {
+        logger.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    detail::Ring &ring = detail::localRing();
+    const size_t head = ring.head.load(std::memory_order_relaxed);
+    size_t tail = ring.tail.load(std::memory_order_acquire);
+    // A full ring waits for the writer rather than losing the line.
+    while (head + size - tail > detail::Ring::capacity) {
+        logger.poke();
+        std::this_thread::yield();
+        tail = ring.tail.load(std::memory_order_acquire);
+    }
+    const uint32_t size32 = uint32_t(size);
+    const uint8_t levelByte = uint8_t(level);
+    size_t position = head;
+    ring.put(position, &size32, sizeof(size32));
+    ring.put(position + sizeof(size32), &levelByte, 1);
+    position += detail::recordHeader;
+    (detail::encode(ring, position, args), ...);
+    ring.head.store(head + size, std::memory_order_release);
+    if (head + size - tail > detail::Ring::capacity / 2) {
+        logger.poke();
+    }
+}
+
+inline void flush() { detail::Logger::instance().flush(); }
+inline void setLevel(Level level) { detail::Logger::instance().minimumLevel.store(level); }
+// Quiet mode drops every record at the call site.
+inline void setQuiet(bool quiet) { detail::Logger::instance().quiet.store(quiet); }
+inline void setSink(std::unique_ptr<Sink> sink) { detail::Logger::instance().setSink(std::move(sink)); }
+// Records too large for a ring, which are dropped rather than split.
+inline uint64_t droppedRecords() { return detail::Logger::instance().dropped.load(); }
+
+}
+
+#endif
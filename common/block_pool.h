@@ -0,0 +1,139 @@
+/*
+ * Allocation on the chat examples' message path: a lock-free fixed-size block
+ * pool for objects allocated per message, and the shared payload they carry.
+ *
+ *     void *p = BlockPool<64>::allocate();
+ *     BlockPool<64>::deallocate(p);
+ *     MessagePayload message("Hello");   // copies share one buffer
+ */
+
+#ifndef DESIGN_PATTERNS_BLOCK_POOL_H
+#define DESIGN_PATTERNS_BLOCK_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Fixed-size block pool for objects allocated on the message path. Each thread
+// allocates from its own pool without taking a lock. Every block remembers the
+// pool it came from: freeing it on the owning thread pushes it back on that
+// pool's free list, and freeing it anywhere else pushes it on the owner's
+// lock-free return stack, which the owner takes over in one exchange when its
+// free list runs dry. Blocks therefore flow back to where they are allocated
+// instead of piling up on consumer threads. When a thread exits its pool goes
+// to a depot and is adopted by the next thread that allocates, together with
+// its chunks and anything still being returned to it.
+template <size_t BlockSize>
+class BlockPool {
+    struct Pool;
+    struct Block {
+        Pool *owner;
+        union {
+            Block *next;
+            alignas(std::max_align_t) unsigned char storage[BlockSize];
+        };
+    };
+    static constexpr size_t blocksPerChunk = 256;
+
+    struct Pool {
+        Block *free = nullptr;
+        std::atomic<Block*> returned{nullptr};
+        std::vector<std::unique_ptr<Block[]>> chunks;
+
+        void refill() {
+            free = returned.exchange(nullptr, std::memory_order_acquire);
+            if (free) {
+                return;
+            }
+            std::unique_ptr<Block[]> chunk(new Block[blocksPerChunk]);
+            for (size_t i = 0; i < blocksPerChunk; i++) {
+                chunk[i].owner = this;
+                chunk[i].next = i + 1 < blocksPerChunk ? &chunk[i + 1] : nullptr;
+            }
+            free = &chunk[0];
+            chunks.push_back(std::move(chunk));
+        }
+        void giveBack(Block *block) {
+            block->next = returned.load(std::memory_order_relaxed);
+            while (!returned.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed)) {
+            }
+        }
+    };
+
+    // Pools of exited threads. Pools are never destroyed, since their blocks
+    // may still be in use, so the depot is never destroyed either.
+    static std::mutex &depotMutex() {
+        static std::mutex *mutex = new std::mutex;
+        return *mutex;
+    }
+    static std::vector<Pool*> &depot() {
+        static std::vector<Pool*> *pools = new std::vector<Pool*>;
+        return *pools;
+    }
+    struct ThreadPool {
+        Pool *pool;
+        ThreadPool() {
+            std::lock_guard<std::mutex> lock(depotMutex());
+            if (depot().empty()) {
+                pool = new Pool;
+            } else {
+                pool = depot().back();
+                depot().pop_back();
+            }
+            current() = pool;
+        }
+        ~ThreadPool() {
+            current() = nullptr;
+            std::lock_guard<std::mutex> lock(depotMutex());
+            depot().push_back(pool);
+        }
+    };
+    // The calling thread's pool, or null if it has not allocated yet; frees
+    // on threads that only consume do not create a pool.
+    static Pool *&current() {
+        thread_local Pool *pool = nullptr;
+        return pool;
+    }
+    static Pool &local() {
+        thread_local ThreadPool owner;
+        return *owner.pool;
+    }
+public:
+    static void *allocate() {
+        Pool &pool = local();
+        if (!pool.free) {
+            pool.refill();
+        }
+        Block *block = pool.free;
+        pool.free = block->next;
+        return block->storage;
+    }
+    static void deallocate(void *pointer) {
+        Block *block = reinterpret_cast<Block*>(static_cast<unsigned char*>(pointer) - offsetof(Block, storage));
+        Pool *owner = block->owner;
+        if (owner == current()) {
+            block->next = owner->free;
+            owner->free = block;
+        } else {
+            owner->giveBack(block);
+        }
+    }
+};
+
+// Immutable, reference-counted message body. Copies share one buffer, so a
+// message fanned out to many subscribers is allocated once and only borrowed
+// as a view along the way.
+class MessagePayload {
+    std::shared_ptr<const std::string> body;
+public:
+    MessagePayload(std::string text) : body(std::make_shared<const std::string>(std::move(text))) {};
+    MessagePayload() = default;
+    MessagePayload(const char *text) : MessagePayload(std::string(text)) {};
+    std::string_view view() const { return body ? std::string_view(*body) : std::string_view(); };
+};
+
+#endif
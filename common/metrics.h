@@ -0,0 +1,453 @@
+/*
+ * Low-overhead latency and fan-out metrics for the message path.
+ *
+ *     StageTimer timer(Metrics::Validate);
+ *     LapTimer laps;
+ *     for (...) { subscriber->notify(...); laps.lapNotify(slot); }
+ *     laps.total(Metrics::Publish);
+ *
+ * Each thread records into its own buffer; Metrics::snapshot() merges them
+ * and prints as text or JSON, and MetricsReporter does so periodically.
+ * When a thread exits its counts are folded into a shared total and its
+ * buffer is handed to the next thread that starts recording.
+ *
+ * Build with CHAT_METRICS=0 to compile recording out; Metrics::setEnabled()
+ * turns it off at runtime.
+ */
+
+#ifndef DESIGN_PATTERNS_METRICS_H
+#define DESIGN_PATTERNS_METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifndef CHAT_METRICS
+#define CHAT_METRICS 1
+#endif
+
+// Log-linear latency histogram in the style of HdrHistogram: values are
+// bucketed by power of two, and each power of two is split into 16 linear
+// sub-buckets, so any recorded value is known to within 1/16 of itself.
+// Only the owning thread records, so a relaxed load/store pair per event is
+// enough and readers merging from other threads still see whole counts.
+class LatencyHistogram {
+public:
+    static constexpr int subBucketBits = 4;
+    static constexpr size_t subBuckets = size_t(1) << subBucketBits;
+    static constexpr size_t bucketCount = (64 - subBucketBits + 1) * subBuckets;
+
+    static size_t bucketOf(uint64_t value) {
+        if (value < subBuckets) {
+            return value;
+        }
+        int shift = 63 - __builtin_clzll(value) - subBucketBits;
+        return (size_t(shift + 1) << subBucketBits) + ((value >> shift) & (subBuckets - 1));
+    }
+    static uint64_t lowestValueOf(size_t bucket) {
+        if (bucket < subBuckets) {
+            return bucket;
+        }
+        int shift = int(bucket >> subBucketBits) - 1;
+        return (subBuckets + (bucket & (subBuckets - 1))) << shift;
+    }
+
+    void record(uint64_t value) {
+        std::atomic<uint64_t> &count = counts[bucketOf(value)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    void addTo(std::vector<uint64_t> &totals) const {
+        for (size_t i = 0; i < bucketCount; i++) {
+            totals[i] += counts[i].load(std::memory_order_relaxed);
+        }
+    }
+    // Moves every count into `other`; the caller makes sure neither side is
+    // being recorded into.
+    void moveTo(LatencyHistogram &other) {
+        for (size_t i = 0; i < bucketCount; i++) {
+            other.counts[i].store(other.counts[i].load(std::memory_order_relaxed) + counts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            counts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+private:
+    std::atomic<uint64_t> counts[bucketCount] = {};
+};
+
+// Merged view of every thread's metrics at one point in time.
+struct MetricsSnapshot {
+    struct StageSummary {
+        const char *stage;
+        uint64_t count;
+        double p50, p99, p999, max;
+    };
+    std::vector<StageSummary> stages;
+    // Notifications sent per group, and notifications slower than the
+    // slow-subscriber threshold per subscriber.
+    std::vector<std::pair<std::string, uint64_t>> fanout;
+    std::vector<std::pair<std::string, uint64_t>> slowSubscribers;
+
+    void writeText(std::ostream &out) const {
+        for (const auto &summary : stages) {
+            out << summary.stage << ": " << summary.count << " events, p50 " << summary.p50 << " ns, p99 " << summary.p99
+                << " ns, p99.9 " << summary.p999 << " ns, max " << summary.max << " ns\n";
+        }
+        for (const auto &group : fanout) {
+            out << "fan-out " << group.first << ": " << group.second << "\n";
+        }
+        for (const auto &subscriber : slowSubscribers) {
+            out << "slow subscriber " << subscriber.first << ": " << subscriber.second << "\n";
+        }
+    }
+
+    void writeJson(std::ostream &out) const {
+        out << "{\"stages\":{";
+        for (size_t i = 0; i < stages.size(); i++) {
+            const StageSummary &summary = stages[i];
+            out << (i ? "," : "") << "\"" << summary.stage << "\":{\"count\":" << summary.count << ",\"p50_ns\":" << summary.p50
+                << ",\"p99_ns\":" << summary.p99 << ",\"p999_ns\":" << summary.p999 << ",\"max_ns\":" << summary.max << "}";
+        }
+        out << "},\"fanout\":";
+        writeJsonCounts(out, fanout);
+        out << ",\"slow_subscribers\":";
+        writeJsonCounts(out, slowSubscribers);
+        out << "}\n";
+    }
+private:
+    static void writeJsonCounts(std::ostream &out, const std::vector<std::pair<std::string, uint64_t>> &counts) {
+        out << "{";
+        for (size_t i = 0; i < counts.size(); i++) {
+            out << (i ? "," : "") << "\"";
+            for (char c : counts[i].first) {
+                if (c == '"' || c == '\\') {
+                    out << '\\' << c;
+                } else if (static_cast<unsigned char>(c) >= 0x20) {
+                    out << c;
+                }
+            }
+            out << "\":" << counts[i].second;
+        }
+        out << "}";
+    }
+};
+
+// Low-overhead instrumentation for the message path. Every thread records
+// into its own buffer (stage latency histograms, per-group fan-out counters
+// and per-subscriber slow-notify counters) with no shared writes;
+// snapshot() merges all buffers on demand. A buffer is folded into a shared
+// total when its thread exits and then reused, so memory and snapshot cost
+// follow the number of live threads rather than every thread ever started.
+// Timestamps are raw TSC ticks on
+// x86 and are only converted to nanoseconds when a snapshot is taken.
+// Groups and subscribers are identified by the slots register*() returns,
+// which callers keep next to whatever they describe.
+class Metrics {
+public:
+    enum Stage { Validate, Execute, Publish, Notify, stageCount };
+    static constexpr bool compiledIn = CHAT_METRICS != 0;
+    static constexpr size_t unregistered = SIZE_MAX;
+    static constexpr size_t maxGroups = 256;
+    static constexpr size_t maxSubscribers = 4096;
+
+    // Recording can also be switched off at runtime; while it is, timers
+    // read no clock and record nothing.
+    static bool enabled() {
+        return compiledIn && on.load(std::memory_order_relaxed);
+    }
+    static void setEnabled(bool on) {
+        Metrics::on.store(on, std::memory_order_relaxed);
+    }
+
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    static void record(Stage stage, uint64_t ticks) {
+        local().stages[stage].record(ticks);
+    }
+    static void countFanout(size_t groupSlot, uint64_t notifications) {
+        if (enabled() && groupSlot < maxGroups) {
+            bump(local().fanout[groupSlot], notifications);
+        }
+    }
+    // Records one notify() call and flags it if it took too long.
+    static void recordNotify(size_t subscriberSlot, uint64_t ticks) {
+        ThreadMetrics &metrics = local();
+        metrics.stages[Notify].record(ticks);
+        if (ticks > slowThreshold.load(std::memory_order_relaxed) && subscriberSlot < maxSubscribers) {
+            bump(metrics.slowNotifies[subscriberSlot], 1);
+        }
+    }
+
+    static size_t registerGroup(const std::string & name) {
+        return addName(registry().groupNames, name, maxGroups);
+    }
+    // A subscriber registered again, e.g. by a second group, gets its
+    // existing slot back.
+    static size_t registerSubscriber(const std::string & name) {
+        Registry &all = registry();
+        {
+            std::lock_guard<std::mutex> lock(all.mutex);
+            auto found = all.subscriberSlots.find(name);
+            if (found != all.subscriberSlots.end()) {
+                return found->second;
+            }
+        }
+        const size_t slot = addName(all.subscriberNames, name, maxSubscribers);
+        if (slot != unregistered) {
+            std::lock_guard<std::mutex> lock(all.mutex);
+            all.subscriberSlots.emplace(name, slot);
+        }
+        return slot;
+    }
+    static void setSlowSubscriberThreshold(std::chrono::nanoseconds threshold) {
+        slowThreshold = uint64_t(threshold.count() * ticksPerNanosecond());
+    }
+
+    static MetricsSnapshot snapshot() {
+        Registry &all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        const double scale = 1.0 / ticksPerNanosecond();
+        static const char *stageNames[stageCount] = {"validate", "execute", "publish", "notify"};
+        MetricsSnapshot snapshot;
+        for (int stage = 0; stage < stageCount; stage++) {
+            std::vector<uint64_t> totals(LatencyHistogram::bucketCount);
+            all.retired->stages[stage].addTo(totals);
+            for (ThreadMetrics *metrics : all.threads) {
+                metrics->stages[stage].addTo(totals);
+            }
+            uint64_t count = 0;
+            for (auto total : totals) {
+                count += total;
+            }
+            MetricsSnapshot::StageSummary summary{stageNames[stage], count, 0, 0, 0, 0};
+            uint64_t seen = 0;
+            for (size_t bucket = 0; bucket < totals.size(); bucket++) {
+                if (totals[bucket] == 0) {
+                    continue;
+                }
+                const double value = LatencyHistogram::lowestValueOf(bucket) * scale;
+                const uint64_t before = seen;
+                seen += totals[bucket];
+                if (before < count * 0.5 && seen >= count * 0.5) summary.p50 = value;
+                if (before < count * 0.99 && seen >= count * 0.99) summary.p99 = value;
+                if (before < count * 0.999 && seen >= count * 0.999) summary.p999 = value;
+                summary.max = value;
+            }
+            snapshot.stages.push_back(summary);
+        }
+        collect(all.groupNames, [](ThreadMetrics &metrics, size_t slot) -> std::atomic<uint64_t> & { return metrics.fanout[slot]; }, snapshot.fanout);
+        collect(all.subscriberNames, [](ThreadMetrics &metrics, size_t slot) -> std::atomic<uint64_t> & { return metrics.slowNotifies[slot]; }, snapshot.slowSubscribers);
+        return snapshot;
+    }
+private:
+    struct ThreadMetrics {
+        LatencyHistogram stages[stageCount];
+        std::atomic<uint64_t> fanout[maxGroups] = {};
+        std::atomic<uint64_t> slowNotifies[maxSubscribers] = {};
+    };
+    // `threads` holds the buffers of live threads. An exiting thread adds its
+    // counts to `retired`, so its events still show up in later snapshots,
+    // and leaves its zeroed buffer in `spare` for the next thread.
+    struct Registry {
+        std::mutex mutex;
+        std::vector<ThreadMetrics*> threads;
+        std::unique_ptr<ThreadMetrics> retired = std::make_unique<ThreadMetrics>();
+        std::vector<std::unique_ptr<ThreadMetrics>> spare;
+        std::vector<std::string> groupNames;
+        std::vector<std::string> subscriberNames;
+        std::unordered_map<std::string, size_t> subscriberSlots;
+    };
+    // Read on every event, so kept out of the registry: constant-initialized
+    // statics need no initialization check.
+    static inline std::atomic<bool> on{true};
+    static inline std::atomic<uint64_t> slowThreshold{UINT64_MAX};
+    static inline thread_local ThreadMetrics *current = nullptr;
+
+    static Registry &registry() {
+        static Registry instance;
+        return instance;
+    }
+    static ThreadMetrics &local() {
+        ThreadMetrics *metrics = current;
+        return metrics ? *metrics : attach();
+    }
+    // Owns the calling thread's buffer and gives it back when the thread
+    // exits. Only attach() touches it, so recording never pays for the
+    // thread_local's initialization check.
+    struct ThreadOwner {
+        std::unique_ptr<ThreadMetrics> metrics;
+        ~ThreadOwner() {
+            if (metrics) {
+                detach(std::move(metrics));
+            }
+        }
+    };
+
+    static ThreadMetrics &attach() {
+        Registry &all = registry();
+        static thread_local ThreadOwner owner;
+        std::lock_guard<std::mutex> lock(all.mutex);
+        if (all.spare.empty()) {
+            owner.metrics = std::make_unique<ThreadMetrics>();
+        } else {
+            owner.metrics = std::move(all.spare.back());
+            all.spare.pop_back();
+        }
+        all.threads.push_back(owner.metrics.get());
+        current = owner.metrics.get();
+        return *current;
+    }
+    static void detach(std::unique_ptr<ThreadMetrics> metrics) {
+        Registry &all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        ThreadMetrics &retired = *all.retired;
+        for (int stage = 0; stage < stageCount; stage++) {
+            metrics->stages[stage].moveTo(retired.stages[stage]);
+        }
+        for (size_t slot = 0; slot < maxGroups; slot++) {
+            bump(retired.fanout[slot], metrics->fanout[slot].exchange(0, std::memory_order_relaxed));
+        }
+        for (size_t slot = 0; slot < maxSubscribers; slot++) {
+            bump(retired.slowNotifies[slot], metrics->slowNotifies[slot].exchange(0, std::memory_order_relaxed));
+        }
+        all.threads.erase(std::find(all.threads.begin(), all.threads.end(), metrics.get()));
+        all.spare.push_back(std::move(metrics));
+        current = nullptr;
+    }
+    static void bump(std::atomic<uint64_t> &counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+    static size_t addName(std::vector<std::string> &names, const std::string & name, size_t capacity) {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        if (names.size() == capacity) {
+            return unregistered;
+        }
+        names.push_back(name);
+        return names.size() - 1;
+    }
+    template <typename Counter>
+    static void collect(const std::vector<std::string> &names, Counter counter, std::vector<std::pair<std::string, uint64_t>> &out) {
+        for (size_t slot = 0; slot < names.size(); slot++) {
+            uint64_t total = counter(*registry().retired, slot).load(std::memory_order_relaxed);
+            for (ThreadMetrics *metrics : registry().threads) {
+                total += counter(*metrics, slot).load(std::memory_order_relaxed);
+            }
+            if (total) {
+                out.emplace_back(names[slot], total);
+            }
+        }
+    }
+    // Measured once against steady_clock over a couple of milliseconds.
+    static double ticksPerNanosecond() {
+#if defined(__x86_64__) || defined(__i386__)
+        static const double ratio = [] {
+            auto start = std::chrono::steady_clock::now();
+            uint64_t startTicks = now();
+            while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(2)) {
+            }
+            uint64_t ticks = now() - startTicks;
+            return double(ticks) / std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }();
+        return ratio;
+#else
+        return 1.0;
+#endif
+    }
+};
+
+// Times one stage from construction until stop() or the end of the scope.
+class StageTimer {
+    Metrics::Stage stage;
+    bool running;
+    uint64_t start;
+public:
+    StageTimer(Metrics::Stage stage) : stage(stage), running(Metrics::enabled()), start(running ? Metrics::now() : 0) {};
+    ~StageTimer() { stop(); };
+    void stop() {
+        if (running) {
+            Metrics::record(stage, Metrics::now() - start);
+            running = false;
+        }
+    }
+};
+
+// Times a run of back-to-back events with one clock read each: every lap
+// ends one event and starts the next, so a publish to N subscribers reads
+// the clock N + 1 times instead of 2N + 2 and total() costs no read at all.
+class LapTimer {
+    bool running;
+    uint64_t first;
+    uint64_t last;
+
+    uint64_t next() {
+        const uint64_t now = Metrics::now();
+        const uint64_t ticks = now - last;
+        last = now;
+        return ticks;
+    }
+public:
+    LapTimer() : running(Metrics::enabled()), first(running ? Metrics::now() : 0), last(first) {};
+    void lap(Metrics::Stage stage) {
+        if (running) {
+            Metrics::record(stage, next());
+        }
+    }
+    void lapNotify(size_t subscriberSlot) {
+        if (running) {
+            Metrics::recordNotify(subscriberSlot, next());
+        }
+    }
+    // Records everything since construction, up to the last lap, as one event.
+    void total(Metrics::Stage stage) {
+        if (running) {
+            Metrics::record(stage, last - first);
+        }
+    }
+};
+
+// Periodically writes a JSON snapshot of all metrics to a stream.
+class MetricsReporter {
+    std::ostream &out;
+    std::chrono::milliseconds interval;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    bool stopping = false;
+    std::thread thread;
+public:
+    MetricsReporter(std::ostream &out, std::chrono::milliseconds interval) : out(out), interval(interval) {
+        thread = std::thread([this] {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!wakeUp.wait_for(lock, this->interval, [this] { return stopping; })) {
+                Metrics::snapshot().writeJson(this->out);
+            }
+        });
+    }
+    ~MetricsReporter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeUp.notify_one();
+        thread.join();
+    }
+};
+
+#endif
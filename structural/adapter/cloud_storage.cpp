@@ -2,6 +2,11 @@
 #include <string>
 #include <memory>
 #include <ctime>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include "../../common/async_log.h"
 
 using namespace std;
 
@@ -18,7 +23,7 @@ class CloudDrive : public CloudStorage
 public:
     bool uploadContents(const string& content) override
     {
-        cout << "Uploading " << content.length() << " bytes to CloudDrive: " << endl;
+        LOG_INFO("Uploading ", content.length(), " bytes to CloudDrive: ");
 
         return true;
     }
@@ -27,7 +32,7 @@ public:
     {
         // Implement the logic for getting the free space on CloudDrive here.
         const int size = rand() % 20;
-        cout << "Available CloudDrive storage: " << size << "GB" << endl;
+        LOG_INFO("Available CloudDrive storage: ", size, "GB");
         return size;
     }
 };
@@ -37,14 +42,14 @@ class FastShare : public CloudStorage
 public:
     bool uploadContents(const string& content) override
     {
-        cout << "Uploading " << content.length() << " bytes to FastShare: " << endl;
+        LOG_INFO("Uploading ", content.length(), " bytes to FastShare: ");
         return true;
     }
 
     int getFreeSpace() override
     {
         const int size = rand() % 10;
-        cout << "Available FastShare storage: " << size << "GB" << endl;
+        LOG_INFO("Available FastShare storage: ", size, "GB");
         return size;
     }
 };
@@ -55,7 +60,7 @@ class VirtualDrive
 public:
     bool uploadData(const string& data, const int uniqueID)
     {
-        cout << "Uploading to VirtualDrive: \"" << data << "\" ID: " << uniqueID << endl;
+        LOG_INFO("Uploading to VirtualDrive: \"", data, "\" ID: ", uniqueID);
         return true;
     }
     int usedSpace()
@@ -65,23 +70,170 @@ public:
     const int totalSpace = 15;
 };
 
+// Upload IDs from a per-thread xorshift generator, so concurrent uploads
+// neither race on nor contend for the shared rand() state.
+class UploadIds
+{
+public:
+    static int next()
+    {
+        static atomic<uint32_t> threads{0};
+        thread_local uint32_t state = (threads.fetch_add(1, memory_order_relaxed) + 1) * 0x9E3779B9u;
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state % 999;
+    }
+};
+
+// Upload counters split into cache-line sized shards. Each thread updates
+// its own shard, so uploads from different threads never share a line.
+class UsageShards
+{
+public:
+    static constexpr size_t shardCount = 64;
+    // A shard adds its unreconciled bytes to the shared total in steps of
+    // this much, so the total lags by at most this per shard.
+    static constexpr uint64_t publishBytes = 1 << 16;
+    struct alignas(64) Shard
+    {
+        atomic<uint64_t> uploads{0};
+        atomic<uint64_t> bytes{0};
+        // Unreconciled bytes not yet added to the shared total.
+        atomic<uint64_t> unpublished{0};
+    };
+    struct Usage
+    {
+        uint64_t uploads;
+        uint64_t bytes;
+    };
+
+    Shard &local()
+    {
+        static atomic<size_t> threads{0};
+        thread_local size_t shard = threads.fetch_add(1, memory_order_relaxed) % shardCount;
+        return shards[shard];
+    }
+    // Exact once uploads have stopped; a running total while they continue.
+    Usage total() const
+    {
+        Usage usage{0, 0};
+        for (const auto &shard : shards)
+        {
+            usage.uploads += shard.uploads.load(memory_order_relaxed);
+            usage.bytes += shard.bytes.load(memory_order_relaxed);
+        }
+        return usage;
+    }
+    // Counts bytes uploaded since the adapter last asked the backend. Returns
+    // the new shared total when this upload published the shard's count,
+    // otherwise 0.
+    uint64_t addUnreconciled(Shard &shard, uint64_t length)
+    {
+        if (shard.unpublished.fetch_add(length, memory_order_relaxed) + length < publishBytes)
+        {
+            return 0;
+        }
+        const uint64_t pending = shard.unpublished.exchange(0, memory_order_relaxed);
+        return unreconciled.fetch_add(pending, memory_order_relaxed) + pending;
+    }
+    uint64_t unreconciledBytes() const
+    {
+        return unreconciled.load(memory_order_relaxed);
+    }
+    // Takes off the bytes a backend answer now covers. Bytes published after
+    // `covered` was read stay unreconciled.
+    void markReconciled(uint64_t covered)
+    {
+        unreconciled.fetch_sub(covered, memory_order_relaxed);
+    }
+private:
+    Shard shards[shardCount];
+    alignas(64) atomic<uint64_t> unreconciled{0};
+};
+
 class VirtualDriveAdapter: public CloudDrive{
 private:
     unique_ptr<VirtualDrive> vDrive;
+    UsageShards usage;
+    // Serializes backend queries, which are the expensive part.
+    mutex reconcileMutex;
+    // The backend's last answer in bytes; the drive counts as empty until the first.
+    atomic<int64_t> lastFreeBytes;
+
+    // The backend reports whole GB.
+    static constexpr int64_t bytesPerGB = int64_t(1) << 30;
+    // Once this much has been uploaded since the last reconcile, the upload
+    // that notices refreshes the free space.
+    static constexpr uint64_t reconcileBytes = 1 << 20;
+
+    // Uploads published between reading `covered` and the backend's answer
+    // are counted twice until the next reconcile, which errs towards full.
+    int reconcile()
+    {
+        const uint64_t covered = usage.unreconciledBytes();
+        int freeSpace = vDrive->totalSpace - vDrive->usedSpace();
+        lastFreeBytes.store(freeSpace * bytesPerGB, memory_order_relaxed);
+        usage.markReconciled(covered);
+        return freeSpace;
+    }
 public:
-    VirtualDriveAdapter(): vDrive(make_unique<VirtualDrive>()) {}
+    VirtualDriveAdapter(): vDrive(make_unique<VirtualDrive>()), lastFreeBytes(vDrive->totalSpace * bytesPerGB) {}
 
     bool uploadContents(const string &content){
-        cout << "Uploading " << content.length() << " bytes to VirtualDrive: " << endl;
-        return vDrive->uploadData(content, rand() % 999);
+        // Refused only when the estimate says the content will not fit.
+        if (approximateFreeBytes() < int64_t(content.length()))
+        {
+            LOG_WARN("VirtualDrive is full");
+            return false;
+        }
+        LOG_INFO("Uploading ", content.length(), " bytes to VirtualDrive: ");
+        if (!vDrive->uploadData(content, UploadIds::next()))
+        {
+            return false;
+        }
+        UsageShards::Shard &shard = usage.local();
+        shard.uploads.fetch_add(1, memory_order_relaxed);
+        shard.bytes.fetch_add(content.length(), memory_order_relaxed);
+        if (usage.addUnreconciled(shard, content.length()) >= reconcileBytes)
+        {
+            // Lazy: if another thread is already asking the backend, its answer will do.
+            unique_lock<mutex> lock(reconcileMutex, try_to_lock);
+            if (lock.owns_lock())
+            {
+                reconcile();
+            }
+        }
+        return true;
     }
+    // Exact: asks the backend.
     int getFreeSpace(){
-        int freeSpace = vDrive->totalSpace - vDrive->usedSpace();
-        cout << "Available VirtualDrive storage: " << freeSpace << "GB" << endl;
+        int freeSpace;
+        {
+            lock_guard<mutex> lock(reconcileMutex);
+            freeSpace = reconcile();
+        }
+        LOG_INFO("Available VirtualDrive storage: ", freeSpace, "GB");
         return freeSpace;
     }
+    // Cheap: the backend's last answer less what has been uploaded since.
+    // Each shard's last publishBytes may not be counted yet.
+    int64_t approximateFreeBytes() const
+    {
+        return lastFreeBytes.load(memory_order_relaxed) - int64_t(usage.unreconciledBytes());
+    }
+    // The same in whole GB, as the backend reports it.
+    int approximateFreeSpace() const
+    {
+        return int(approximateFreeBytes() / bytesPerGB);
+    }
+    UsageShards::Usage uploaded() const
+    {
+        return usage.total();
+    }
 };
 
+#ifdef DEMO_MAIN
 int main()
 {
     // Create an array of pointers to CloudStorage objects.
@@ -99,8 +251,10 @@ int main()
     {        
         service->uploadContents(content);
         service->getFreeSpace();
+        asynclog::flush();
         cout << endl;
     }
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -1,6 +1,8 @@
 #include <iostream>
 #include <memory>
 
+#include "../../common/async_log.h"
+
 class IEngine{
 public:
     virtual void start() const = 0;
@@ -27,21 +29,21 @@ private:
 class EvEngine: public IEngine{
 public:
     virtual void start() const override{
-        std::cout<<"Starting EvEngine"<<std::endl;
+        LOG_INFO("Starting EvEngine");
     }
 };
 
 class IceEngine: public IEngine{
 public:
     virtual void start() const override{
-        std::cout<<"Starting IceEngine"<<std::endl;
+        LOG_INFO("Starting IceEngine");
     }
 };
 
 class HybridEngine: public IEngine{
 public:
     virtual void start() const override{
-        std::cout<<"Starting HybridEngine"<<std::endl;
+        LOG_INFO("Starting HybridEngine");
     }
 };
 
@@ -50,7 +52,7 @@ class car: public IVehicle{
 public:
     car(const IEngine &engine): IVehicle(engine) {} 
     virtual void driveVehicle() const override{
-        std::cout<<"Driving car"<<std::endl;
+        LOG_INFO("Driving car");
     }
 };
 
@@ -58,10 +60,11 @@ class truck: public IVehicle{
 public:
     truck(const IEngine &engine): IVehicle(engine) {} 
     virtual void driveVehicle() const override{
-        std::cout<<"Driving truck"<<std::endl;
+        LOG_INFO("Driving truck");
     }
 };
 
+#ifdef DEMO_MAIN
 int main(){
     auto ev = EvEngine();
     auto hybrid = HybridEngine();
@@ -75,7 +78,9 @@ int main(){
 
     for(const auto &vehicle : vehicles){
         vehicle->drive();
+        asynclog::flush();
         std::cout<<std::endl;
     }
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -1,7 +1,8 @@
-#include <iostream>
 #include <memory>
 #include <vector>
 
+#include "../../common/async_log.h"
+
 class Shape{
 public:
     virtual void draw() const = 0;
@@ -14,7 +15,7 @@ private:
 
 public:
     virtual void draw() const override{
-        std::cout<<"Drawing composite shapes..."<<std::endl;
+        LOG_INFO("Drawing composite shapes...");
         for(const auto &shape: shapes){
             shape->draw();
         }
@@ -32,7 +33,7 @@ public:
     Rectangle(int l, int b): length(l), breadth(b) {}
 
     virtual void draw() const override{
-        std::cout<<"Drawing rectangle with length "<<length<<" breadth "<<breadth<<std::endl;
+        LOG_INFO("Drawing rectangle with length ", length, " breadth ", breadth);
     }
 };
 
@@ -43,10 +44,11 @@ public:
     Circle(int r): radius(r){}
     
     virtual void draw() const override{
-        std::cout<<"Drawing circle with radius "<<radius<<std::endl;
+        LOG_INFO("Drawing circle with radius ", radius);
     }
 };
 
+#ifdef DEMO_MAIN
 int main(){
     Circle c(5);
     Rectangle r(10, 15);
@@ -57,4 +59,5 @@ int main(){
     cs.draw();
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -93,6 +93,7 @@ public:
     }
 };
 
+#ifdef DEMO_MAIN
 int main()
 {
     const std::unique_ptr<Pizza> pizzas[]{
@@ -116,4 +117,5 @@ int main()
         cout << pizzawithtoppings->description() << " costs $" << pizzawithtoppings->price() << endl;
     }
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -1,6 +1,16 @@
 #include <iostream>
 #include <string>
 #include <tuple>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "../../common/async_log.h"
 
 using namespace std;
 
@@ -9,7 +19,7 @@ class WorldWeatherAPI
 public:
     tuple<float, float, string> getWeather(string location)
     {
-        cout << "Calling worldWeather with location: " << location << endl;
+        LOG_DEBUG("Calling worldWeather with location: ", location);
         float temperature = 20.0f;
         float windSpeed = 5.5f;
         string shortDescription = "Sunny";
@@ -22,7 +32,7 @@ class FreeWeather
 public:
     tuple<float, string> retrieve_weather(string location)
     {
-        cout << "Calling freeWeather with location: " << location << endl;
+        LOG_DEBUG("Calling freeWeather with location: ", location);
         float temperature = 22.0f;
         string shortDescription = "Sunny";
         return make_tuple(temperature, shortDescription);
@@ -34,7 +44,7 @@ class RealtimeWeatherService
 public:
     tuple<float, float, string> weatherConditions(string location)
     {
-        cout << "Calling realtimeWeather with location: " << location << endl;
+        LOG_DEBUG("Calling realtimeWeather with location: ", location);
         float temperature = 19.5f;
         float humidity = 60.0f;
         string shortDescription = "Partly cloudy with a chance of rain";
@@ -53,6 +63,350 @@ public:
     }
 };
 
+// Serves currentWeather from a cache and refreshes the locations that are
+// asked for often before their entries expire, so regular traffic does not
+// wait on the providers. Each provider's part of an entry is refreshed on
+// its own, within that provider's rate limit. Time is passed in by the
+// caller, who also calls runPrefetch() regularly (e.g. once a second).
+// Not thread safe.
+class PrefetchingWeather
+{
+public:
+    using Clock = chrono::steady_clock;
+    enum Provider { WorldWeather, FreeWeather, RealtimeWeather, providerCount };
+
+    struct Options
+    {
+        Clock::duration ttl = chrono::hours(1);
+        // Hot entries are refreshed at most this long before they expire.
+        Clock::duration refreshAhead = chrono::minutes(10);
+        // A location asked for hotRequests times within the current and
+        // previous window is hot.
+        Clock::duration window = chrono::hours(1);
+        unsigned hotRequests = 2;
+        bool prefetch = true;
+        // Background refreshes allowed per second, per provider. Zero turns
+        // prefetching off for that provider; it is then only fetched on demand.
+        double refreshesPerSecond[providerCount] = {1, 1, 1};
+    };
+
+    struct Stats
+    {
+        uint64_t requests = 0;
+        // Requests that had to wait for at least one provider.
+        uint64_t coldMisses = 0;
+        uint64_t onDemandCalls[providerCount] = {};
+        uint64_t prefetchCalls[providerCount] = {};
+
+        uint64_t providerCalls() const
+        {
+            uint64_t calls = 0;
+            for (int p = 0; p < providerCount; p++)
+            {
+                calls += onDemandCalls[p] + prefetchCalls[p];
+            }
+            return calls;
+        }
+        double coldMissRate() const
+        {
+            return requests ? double(coldMisses) / requests : 0;
+        }
+    };
+
+private:
+    struct Entry
+    {
+        tuple<float, float, string> world;
+        tuple<float, string> free;
+        tuple<float, float, string> realtime;
+        Clock::time_point fetched[providerCount] = {Clock::time_point::min(), Clock::time_point::min(), Clock::time_point::min()};
+        Clock::time_point windowStart;
+        unsigned requests = 0;
+        unsigned previousRequests = 0;
+        // When the entry is next looked at by runPrefetch(); max() if never.
+        Clock::time_point due = Clock::time_point::max();
+    };
+
+    struct Scheduled
+    {
+        Clock::time_point due;
+        string location;
+        bool operator>(const Scheduled &other) const { return due > other.due; }
+    };
+
+    // Token bucket holding at most one second's worth of refreshes.
+    struct RateLimit
+    {
+        double perSecond;
+        double tokens = 0;
+        Clock::time_point refilled = Clock::time_point::min();
+
+        bool take(Clock::time_point now)
+        {
+            const double burst = max(1.0, perSecond);
+            tokens = refilled == Clock::time_point::min() ? burst
+                : min(burst, tokens + perSecond * chrono::duration<double>(now - refilled).count());
+            refilled = now;
+            if (tokens < 1)
+            {
+                return false;
+            }
+            tokens -= 1;
+            return true;
+        }
+        bool disabled() const
+        {
+            return perSecond == 0;
+        }
+        // Time between tokens, capped at `longest` so that very low rates
+        // cannot overflow a Clock::duration.
+        Clock::duration interval(Clock::duration longest) const
+        {
+            if (disabled())
+            {
+                return longest;
+            }
+            const chrono::duration<double> wait(1 / perSecond);
+            return wait < longest ? chrono::duration_cast<Clock::duration>(wait) : longest;
+        }
+    };
+
+    Weather weather;
+    Options options;
+    Stats stats;
+    unordered_map<string, Entry> entries;
+    priority_queue<Scheduled, vector<Scheduled>, greater<Scheduled>> queue;
+    RateLimit limits[providerCount];
+    Clock::time_point lastSweep = Clock::time_point::min();
+
+    bool fresh(const Entry &entry, int provider, Clock::time_point now) const
+    {
+        return entry.fetched[provider] + options.ttl > now;
+    }
+    void fetch(Entry &entry, const string &location, int provider, Clock::time_point now)
+    {
+        switch (provider)
+        {
+        case WorldWeather:
+            entry.world = weather.getWeather(location);
+            break;
+        case FreeWeather:
+            entry.free = weather.retrieve_weather(location);
+            break;
+        case RealtimeWeather:
+            entry.realtime = weather.weatherConditions(location);
+            break;
+        }
+        entry.fetched[provider] = now;
+    }
+    void rollWindow(Entry &entry, Clock::time_point now) const
+    {
+        if (now - entry.windowStart >= options.window)
+        {
+            entry.previousRequests = now - entry.windowStart < 2 * options.window ? entry.requests : 0;
+            entry.requests = 0;
+            entry.windowStart = now;
+        }
+    }
+    bool hot(const Entry &entry) const
+    {
+        return entry.requests + entry.previousRequests >= options.hotRequests;
+    }
+    // Due somewhere in the refreshAhead window before the entry's first part
+    // expires, at an offset fixed per location, so that entries fetched
+    // together are not all refreshed at once.
+    void schedule(const string &location, Entry &entry)
+    {
+        Clock::time_point expiry = Clock::time_point::max();
+        for (int p = 0; p < providerCount; p++)
+        {
+            if (!limits[p].disabled())
+            {
+                expiry = min(expiry, entry.fetched[p] + options.ttl);
+            }
+        }
+        if (expiry == Clock::time_point::max())
+        {
+            return;
+        }
+        const long slot = long(hash<string>{}(location) % 1024);
+        entry.due = expiry - options.refreshAhead + options.refreshAhead * slot / 1024;
+        queue.push({entry.due, location});
+    }
+    // Forgets locations nobody has asked for in two windows.
+    void sweep(Clock::time_point now)
+    {
+        for (auto entry = entries.begin(); entry != entries.end();)
+        {
+            rollWindow(entry->second, now);
+            if (entry->second.due == Clock::time_point::max() && entry->second.requests + entry->second.previousRequests == 0)
+            {
+                entry = entries.erase(entry);
+            }
+            else
+            {
+                ++entry;
+            }
+        }
+    }
+
+public:
+    PrefetchingWeather(): PrefetchingWeather(Options()) {}
+    PrefetchingWeather(const Options &options): options(options)
+    {
+        for (int p = 0; p < providerCount; p++)
+        {
+            if (!(options.refreshesPerSecond[p] >= 0))
+            {
+                throw invalid_argument("refreshesPerSecond must be zero or positive");
+            }
+            limits[p].perSecond = options.refreshesPerSecond[p];
+        }
+    }
+
+    tuple<float, float, string> currentWeather(const string &location, Clock::time_point now)
+    {
+        stats.requests++;
+        Entry &entry = entries[location];
+        rollWindow(entry, now);
+        entry.requests++;
+        bool cold = false;
+        for (int p = 0; p < providerCount; p++)
+        {
+            if (!fresh(entry, p, now))
+            {
+                fetch(entry, location, p, now);
+                stats.onDemandCalls[p]++;
+                cold = true;
+            }
+        }
+        if (cold)
+        {
+            stats.coldMisses++;
+        }
+        if (options.prefetch && entry.due == Clock::time_point::max() && hot(entry))
+        {
+            schedule(location, entry);
+        }
+        return make_tuple(get<0>(entry.world), get<1>(entry.realtime), get<1>(entry.free));
+    }
+
+    // Refreshes the hot entries that are due, as far as the rate limits
+    // allow; the rest are retried once their provider has capacity again.
+    void runPrefetch(Clock::time_point now)
+    {
+        while (!queue.empty() && queue.top().due <= now)
+        {
+            const Scheduled next = queue.top();
+            queue.pop();
+            auto found = entries.find(next.location);
+            if (found == entries.end() || found->second.due != next.due)
+            {
+                continue;
+            }
+            Entry &entry = found->second;
+            entry.due = Clock::time_point::max();
+            rollWindow(entry, now);
+            if (!hot(entry))
+            {
+                continue;
+            }
+            Clock::duration retry = Clock::duration::zero();
+            for (int p = 0; p < providerCount; p++)
+            {
+                if (limits[p].disabled() || fresh(entry, p, now + options.refreshAhead))
+                {
+                    continue;
+                }
+                if (limits[p].take(now))
+                {
+                    fetch(entry, next.location, p, now);
+                    stats.prefetchCalls[p]++;
+                }
+                else
+                {
+                    retry = max(retry, limits[p].interval(options.ttl));
+                }
+            }
+            if (retry > Clock::duration::zero())
+            {
+                entry.due = now + retry;
+                queue.push({entry.due, next.location});
+            }
+            else
+            {
+                schedule(next.location, entry);
+            }
+        }
+        if (lastSweep == Clock::time_point::min() || now - lastSweep >= options.window)
+        {
+            sweep(now);
+            lastSweep = now;
+        }
+    }
+
+    const Stats &statistics() const
+    {
+        return stats;
+    }
+};
+
+struct TrafficReport
+{
+    PrefetchingWeather::Stats stats;
+    double averageQps;
+    uint64_t peakQps;
+};
+
+// A day of hourly traffic: 20 regions asked for 5 times each in the first two
+// minutes of every hour, plus 30 one-off locations spread over each hour.
+TrafficReport simulateDay(const PrefetchingWeather::Options &options)
+{
+    using Clock = PrefetchingWeather::Clock;
+    const int seconds = 24 * 3600;
+    uint32_t seed = 1;
+    auto random = [&seed] {
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    };
+    vector<pair<int, string>> requests;
+    for (int hour = 0; hour < 24; hour++)
+    {
+        for (int region = 0; region < 20; region++)
+        {
+            for (int i = 0; i < 5; i++)
+            {
+                requests.emplace_back(hour * 3600 + random() % 120, "Region " + to_string(region));
+            }
+        }
+        for (int i = 0; i < 30; i++)
+        {
+            requests.emplace_back(hour * 3600 + random() % 3600, "Town " + to_string(hour * 30 + i));
+        }
+    }
+    stable_sort(requests.begin(), requests.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+
+    PrefetchingWeather weather(options);
+    const Clock::time_point start = Clock::time_point() + chrono::hours(24);
+    TrafficReport report{};
+    auto request = requests.begin();
+    for (int second = 0; second < seconds; second++)
+    {
+        const Clock::time_point now = start + chrono::seconds(second);
+        const uint64_t callsBefore = weather.statistics().providerCalls();
+        weather.runPrefetch(now);
+        for (; request != requests.end() && request->first == second; ++request)
+        {
+            weather.currentWeather(request->second, now);
+        }
+        report.peakQps = max(report.peakQps, weather.statistics().providerCalls() - callsBefore);
+    }
+    report.stats = weather.statistics();
+    report.averageQps = double(report.stats.providerCalls()) / seconds;
+    return report;
+}
+
+#ifdef DEMO_MAIN
 int main()
 {
 /*
@@ -82,10 +436,35 @@ int main()
     Weather weather;
 
     auto weatherResult = weather.currentWeather(location);
+    asynclog::flush();
     cout << "\nWeather for " << location << endl
          << get<2>(weatherResult) << endl
          << "Temperature: " << get<1>(weatherResult) << " C" << endl
          << "Humidity: " << get<0>(weatherResult) << " %" << endl;
 
+    // Compare fetching on every request, caching on demand and prefetching
+    // over a simulated day; the providers' own logging would drown it out.
+    asynclog::setQuiet(true);
+    PrefetchingWeather::Options noCache;
+    noCache.ttl = chrono::seconds(0);
+    noCache.prefetch = false;
+    PrefetchingWeather::Options onDemand;
+    onDemand.prefetch = false;
+    const pair<const char *, PrefetchingWeather::Options> strategies[] = {
+        {"No cache", noCache},
+        {"On-demand cache", onDemand},
+        {"Prefetch", PrefetchingWeather::Options()}
+    };
+    cout << "\nA simulated day of hourly traffic:" << endl;
+    for (const auto &strategy : strategies)
+    {
+        TrafficReport report = simulateDay(strategy.second);
+        cout << strategy.first << ": " << report.stats.requests << " requests, cold-miss rate "
+             << report.stats.coldMissRate() * 100 << " %, provider QPS " << report.averageQps
+             << " average, " << report.peakQps << " peak" << endl;
+    }
+    asynclog::setQuiet(false);
+
     return 0;
-}
\ No newline at end of file
+}
+#endif
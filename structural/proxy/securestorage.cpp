@@ -2,6 +2,8 @@
 #include <string>
 #include <memory>
 
+#include "../../common/async_log.h"
+
 using namespace std;
 
 class Storage
@@ -37,11 +39,12 @@ public:
     SecureStorageProxy(const string &s, const int c): secureStorage(make_unique<SecureStorage>(s)), code(c) {}
     virtual const string getContents() override{
         if(auth(code)) return secureStorage->getContents();
-        else cout<<"Access denied"<<endl;
+        else LOG_WARN("Access denied");
         return "";
     }
 };
 
+#ifdef DEMO_MAIN
 int main()
 {
     SecureStorageProxy secureStorage("Top Secret Information", 1431);
@@ -50,4 +53,5 @@ int main()
     cout << "Sensitive Data: " << secureStorage.getContents() << endl;
 
     return 0;
-}
\ No newline at end of file
+}
+#endif